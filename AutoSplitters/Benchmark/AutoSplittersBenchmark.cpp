@@ -0,0 +1,54 @@
+// ILikeBanas
+
+#include "Benchmark.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace AutoSplittersBenchmark
+{
+    double Scale = 1.0;
+    double LastNanoseconds = 0.0;
+}
+
+namespace
+{
+    struct FBenchmark
+    {
+        const char* Name;
+        void (*Run)();
+    };
+
+    const FBenchmark BENCHMARKS[] = {
+        {"distribution",&AutoSplittersBenchmark::RunDistributionBenchmark},
+        {"solve",&AutoSplittersBenchmark::RunSolveBenchmark},
+        {"select",&AutoSplittersBenchmark::RunSelectBenchmark},
+    };
+}
+
+int main(int argc, char** argv)
+{
+    // usage: AutoSplittersBenchmark [benchmark|all] [scale]
+    const char* Selected = argc > 1 ? argv[1] : "all";
+    if (argc > 2)
+        AutoSplittersBenchmark::Scale = std::atof(argv[2]);
+
+    bool Found = false;
+    for (const auto& Benchmark : BENCHMARKS)
+    {
+        if (std::strcmp(Selected,"all") != 0 && std::strcmp(Selected,Benchmark.Name) != 0)
+            continue;
+
+        std::printf("== %s\n",Benchmark.Name);
+        Benchmark.Run();
+        Found = true;
+    }
+
+    if (!Found)
+    {
+        std::fprintf(stderr,"unknown benchmark %s\n",Selected);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,46 @@
+// ILikeBanas
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+namespace AutoSplittersBenchmark
+{
+    // Iteration counts are multiplied by this, set from the command line
+    extern double Scale;
+
+    // total time of the last call to Measure()
+    extern double LastNanoseconds;
+
+    inline std::int64_t Scaled(const std::int64_t Iterations)
+    {
+        const auto Result = static_cast<std::int64_t>(Iterations * Scale);
+        return Result > 0 ? Result : 1;
+    }
+
+    // Runs Body once and prints its time per iteration. Body returns a checksum that keeps the optimizer honest and
+    // makes different implementations of the same thing comparable.
+    template <typename BodyType>
+    void Measure(const char* Name, const std::int64_t Iterations, BodyType&& Body)
+    {
+        const auto Start = std::chrono::steady_clock::now();
+        const std::int64_t Checksum = Body();
+        const auto End = std::chrono::steady_clock::now();
+
+        const double Nanoseconds = std::chrono::duration<double,std::nano>(End - Start).count();
+        LastNanoseconds = Nanoseconds;
+        std::printf(
+            "%-40s %12lld iterations %10.1f ns/iteration   checksum %lld\n",
+            Name,
+            static_cast<long long>(Iterations),
+            Nanoseconds / Iterations,
+            static_cast<long long>(Checksum)
+            );
+    }
+
+    void RunDistributionBenchmark();
+    void RunSolveBenchmark();
+    void RunSelectBenchmark();
+}
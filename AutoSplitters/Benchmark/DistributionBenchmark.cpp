@@ -0,0 +1,179 @@
+// ILikeBanas
+
+#include "Benchmark.h"
+
+#include "Distribution/AutoSplitterDistribution.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace AutoSplittersBenchmark
+{
+    namespace
+    {
+        using FDistribution = FAutoSplitterDistribution;
+
+        // Rates are in the fixed point unit of the splitter (thousandths of items per minute)
+        struct FRateMix
+        {
+            const char* Name;
+            FDistribution::EMode Mode;
+            std::uint32_t ConnectedOutputs;
+            std::array<std::int32_t,FDistribution::MAX_OUTPUTS> Rates;
+            // outputs whose belt backs up for a quarter of the time
+            std::uint32_t StallingOutputs;
+        };
+
+        constexpr auto Cycles = FDistribution::EMode::Cycles;
+        constexpr auto TokenBuckets = FDistribution::EMode::TokenBuckets;
+
+        const FRateMix RATE_MIXES[] = {
+            {"3 outputs, equal",Cycles,0x07,{260000,260000,260000},0},
+            {"3 outputs, 1:2:3",Cycles,0x07,{130000,260000,390000},0},
+            {"3 outputs, fractional",Cycles,0x07,{100500,333333,12250},0},
+            {"3 outputs, 1:2:3, one stalling",Cycles,0x07,{130000,260000,390000},0x02},
+            {"2 of 3 outputs connected",Cycles,0x05,{390000,0,390000},0},
+            {"8 outputs, 1..8",Cycles,0xFF,{10000,20000,30000,40000,50000,60000,70000,80000},0},
+            {"8 outputs, 1..8, two stalling",Cycles,0xFF,{10000,20000,30000,40000,50000,60000,70000,80000},0x28},
+            {"tokens, 3 outputs, 1:2:3",TokenBuckets,0x07,{130000,260000,390000},0},
+            {"tokens, 3 outputs, fractional",TokenBuckets,0x07,{100500,333333,12250},0},
+            {"tokens, 8 outputs, 1..8",TokenBuckets,0xFF,{10000,20000,30000,40000,50000,60000,70000,80000},0},
+        };
+
+        constexpr float TICK_TIME = 1.0f / 60.0f;
+        // Mk.5 belts
+        constexpr float BELT_RATE = 780.0f / 60.0f;
+        constexpr std::int32_t STALL_PERIOD = 600;
+
+        // Drives one splitter the way Factory_Tick() and the conveyors do: fill the buffer from the input belt, assign,
+        // let the output belts grab and lock the outputs until the next tick.
+        struct FSimulatedSplitter
+        {
+            FDistribution Distribution;
+            std::array<std::int32_t,FDistribution::MAX_INVENTORY_SIZE> Slots = {};
+            std::int32_t Count = 0;
+            std::uint32_t Occupied = 0;
+            float InputBudget = 0.0f;
+            std::array<float,FDistribution::MAX_OUTPUTS> OutputBudget = {};
+            std::array<std::int64_t,FDistribution::MAX_OUTPUTS> Delivered = {};
+
+            void Tick(const FRateMix& Mix, const std::int64_t Tick)
+            {
+                Distribution.BeginTick();
+
+                InputBudget += BELT_RATE * TICK_TIME;
+                while (InputBudget >= 1.0f && Count < FDistribution::MAX_INVENTORY_SIZE)
+                {
+                    std::int32_t Slot = 0;
+                    while (Occupied & (1u << Slot))
+                        ++Slot;
+                    Occupied |= 1u << Slot;
+                    Slots[Count++] = Slot;
+                    InputBudget -= 1.0f;
+                }
+                // belts that cannot move do not build up any credit
+                InputBudget = std::min(InputBudget,1.0f);
+
+                if (Count > 0)
+                {
+                    if (Distribution.UsesTokenBuckets())
+                    {
+                        if (Distribution.CycleTime >= FDistribution::MIN_CYCLE_TIME)
+                            Distribution.PrepareCycle(false,false);
+                    }
+                    else if (Distribution.NeedsCycleReset())
+                    {
+                        Distribution.PrepareCycle(false,true);
+                    }
+                    else if (Distribution.LeftInCycle <= 0)
+                    {
+                        Distribution.PrepareCycle(true,false);
+                    }
+
+                    Distribution.CycleTime += TICK_TIME;
+                    Distribution.AssignItems(Slots.data(),Count,TICK_TIME);
+                }
+                else
+                {
+                    Distribution.CycleTime += TICK_TIME;
+                }
+
+                const bool Stalled = (Tick / STALL_PERIOD) % 4 == 3;
+                for (std::int32_t i = 0 ; i < FDistribution::MAX_OUTPUTS ; ++i)
+                {
+                    if (!(Mix.ConnectedOutputs & (1u << i)) || (Stalled && (Mix.StallingOutputs & (1u << i))))
+                        continue;
+
+                    OutputBudget[i] += BELT_RATE * TICK_TIME;
+                    if (OutputBudget[i] < 1.0f)
+                        continue;
+
+                    const auto Slot = Distribution.GrabItem(i);
+                    if (Slot == FDistribution::NO_ASSIGNED_ITEM)
+                    {
+                        OutputBudget[i] = 1.0f;
+                        continue;
+                    }
+
+                    OutputBudget[i] -= 1.0f;
+                    ++Delivered[i];
+                    Occupied &= ~(1u << Slot);
+                    Count = static_cast<std::int32_t>(std::remove(Slots.begin(),Slots.begin() + Count,Slot) - Slots.begin());
+                }
+
+                Distribution.LockOutputs();
+            }
+        };
+
+        // largest deviation of the delivered share of any output from its configured share, in percentage points
+        double MaxShareDeviation(const FRateMix& Mix, const FSimulatedSplitter& Splitter)
+        {
+            double TotalRate = 0.0;
+            double TotalDelivered = 0.0;
+            for (std::int32_t i = 0 ; i < FDistribution::MAX_OUTPUTS ; ++i)
+            {
+                if (Mix.ConnectedOutputs & (1u << i))
+                {
+                    TotalRate += Mix.Rates[i];
+                    TotalDelivered += Splitter.Delivered[i];
+                }
+            }
+
+            double Deviation = 0.0;
+            for (std::int32_t i = 0 ; i < FDistribution::MAX_OUTPUTS ; ++i)
+            {
+                if (Mix.ConnectedOutputs & (1u << i))
+                    Deviation = std::max(Deviation,std::abs(Splitter.Delivered[i] / TotalDelivered - Mix.Rates[i] / TotalRate));
+            }
+            return Deviation * 100.0;
+        }
+    }
+
+    void RunDistributionBenchmark()
+    {
+        const auto Ticks = Scaled(1000000);
+
+        for (const auto& Mix : RATE_MIXES)
+        {
+            FSimulatedSplitter Splitter;
+            Splitter.Distribution.Mode = Mix.Mode;
+            Splitter.Distribution.Setup(Mix.ConnectedOutputs,Mix.Rates.data(),false);
+
+            Measure(Mix.Name,Ticks,[&]()
+            {
+                for (std::int64_t Tick = 0 ; Tick < Ticks ; ++Tick)
+                    Splitter.Tick(Mix,Tick);
+
+                std::int64_t Delivered = 0;
+                for (const auto Items : Splitter.Delivered)
+                    Delivered += Items;
+                return Delivered;
+            });
+
+            // stalling outputs are supposed to lose their share while they are stalled
+            if (Mix.StallingOutputs == 0)
+                std::printf("%-40s max share deviation %.3f%%\n","",MaxShareDeviation(Mix,Splitter));
+        }
+    }
+}
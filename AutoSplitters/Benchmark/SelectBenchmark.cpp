@@ -0,0 +1,108 @@
+// ILikeBanas
+
+#include "Benchmark.h"
+
+#include "Distribution/AutoSplitterDistribution.h"
+
+#include <random>
+#include <vector>
+
+namespace AutoSplittersBenchmark
+{
+    namespace
+    {
+        using FDistribution = FAutoSplitterDistribution;
+
+        struct FSelectCase
+        {
+            std::array<std::int32_t,FDistribution::MAX_OUTPUTS> AssignableItems;
+            std::uint32_t Excluded;
+        };
+
+        // Random inputs like AssignItems() sees them: a few assignable items per output, some of them used up or
+        // overdrawn, and now and then an output excluded because it is blocked
+        std::vector<FSelectCase> MakeCases(const std::int32_t Outputs, const std::int32_t Count)
+        {
+            std::mt19937 Random(Outputs);
+            std::uniform_int_distribution<std::int32_t> Items(-2,6);
+            std::uniform_int_distribution<std::int32_t> Excluded(0,7);
+
+            std::vector<FSelectCase> Cases(Count);
+            for (auto& Case : Cases)
+            {
+                Case.AssignableItems.fill(0);
+                Case.Excluded = 0;
+                for (std::int32_t i = 0 ; i < Outputs ; ++i)
+                {
+                    Case.AssignableItems[i] = Items(Random);
+                    if (Excluded(Random) == 0)
+                        Case.Excluded |= 1u << i;
+                }
+            }
+            return Cases;
+        }
+
+        template <typename SelectType>
+        void MeasureSelect(const char* Name, const std::vector<FSelectCase>& Cases, const std::int64_t Rounds, SelectType&& Select)
+        {
+            Measure(Name,Rounds * static_cast<std::int64_t>(Cases.size()),[&]()
+            {
+                std::int64_t Checksum = 0;
+                for (std::int64_t Round = 0 ; Round < Rounds ; ++Round)
+                {
+                    for (const auto& Case : Cases)
+                        Checksum += Select(Case) + 1;
+                }
+                return Checksum;
+            });
+        }
+    }
+
+    void RunSelectBenchmark()
+    {
+        struct FConfiguration
+        {
+            const char* Name;
+            std::int32_t Outputs;
+            std::array<std::int32_t,FDistribution::MAX_OUTPUTS> Rates;
+        };
+
+        const FConfiguration CONFIGURATIONS[] = {
+            {"3 outputs",3,{130000,260000,390000}},
+            {"8 outputs",8,{10000,20000,30000,40000,50000,60000,70000,80000}},
+        };
+
+        const auto Rounds = Scaled(2000);
+
+        for (const auto& Configuration : CONFIGURATIONS)
+        {
+            // Setup() derives the step sizes the selection weighs the items with
+            FDistribution Distribution;
+            Distribution.Setup((1u << Configuration.Outputs) - 1,Configuration.Rates.data(),false);
+
+            const auto Cases = MakeCases(Configuration.Outputs,4096);
+
+            std::int64_t Mismatches = 0;
+            for (const auto& Case : Cases)
+            {
+                if (Distribution.SelectOutput(Case.AssignableItems,Case.Excluded) != Distribution.SelectOutputScalar(Case.AssignableItems,Case.Excluded))
+                    ++Mismatches;
+            }
+
+            char Name[64];
+            std::snprintf(Name,sizeof(Name),"SelectOutput, %s",Configuration.Name);
+            MeasureSelect(Name,Cases,Rounds,[&](const FSelectCase& Case)
+            {
+                return Distribution.SelectOutput(Case.AssignableItems,Case.Excluded);
+            });
+
+            std::snprintf(Name,sizeof(Name),"SelectOutputScalar, %s",Configuration.Name);
+            MeasureSelect(Name,Cases,Rounds,[&](const FSelectCase& Case)
+            {
+                return Distribution.SelectOutputScalar(Case.AssignableItems,Case.Excluded);
+            });
+
+            std::printf("%-40s %lld of %zu picks differ\n","",static_cast<long long>(Mismatches),Cases.size());
+        }
+    }
+}
@@ -0,0 +1,84 @@
+// ILikeBanas
+
+#include "Benchmark.h"
+
+#include "Distribution/AutoSplitterNetworkGraph.h"
+
+namespace AutoSplittersBenchmark
+{
+    namespace
+    {
+        using FGraph = FAutoSplitterNetworkGraph;
+
+        // Mk.5 belts in the fixed point unit of the splitter
+        constexpr std::int32_t BELT_RATE = 780000;
+
+        // Sets up a splitter whose outputs are all connected, with two automatic factory outputs of equal share
+        void SetupNode(FGraph& Graph, const std::int32_t Node)
+        {
+            Graph.MaxOutputRates[Node].fill(0);
+            Graph.AutomaticOutputs[Node] = 0;
+            for (std::int32_t i = 0 ; i < 3 ; ++i)
+            {
+                Graph.MaxOutputRates[Node][i] = BELT_RATE;
+                Graph.PotentialShares[Node][i] = FGraph::FRACTIONAL_SHARE_MULTIPLIER;
+                Graph.AutomaticOutputs[Node] |= 1u << i;
+            }
+        }
+
+        // Splitters feeding each other through output 0, like a manifold
+        void BuildChain(FGraph& Graph, const std::int32_t Nodes)
+        {
+            Graph.Reset();
+            Graph.Reserve(Nodes);
+
+            std::int32_t Node = Graph.AddNode(FGraph::NO_NODE,0);
+            Graph.ManualInputRate[Node] = true;
+            Graph.TargetInputRate[Node] = BELT_RATE;
+            Graph.MaxInputRate[Node] = BELT_RATE;
+            SetupNode(Graph,Node);
+
+            while (Graph.Num() < Nodes)
+            {
+                Node = Graph.AddNode(Node,0);
+                SetupNode(Graph,Node);
+            }
+
+            // every fourth splitter feeds one factory at a fixed rate
+            for (Node = 0 ; Node < Graph.Num() ; Node += 4)
+            {
+                Graph.AutomaticOutputs[Node] &= ~(1u << 2);
+                Graph.OutputRates[Node][2] = 10;
+            }
+        }
+    }
+
+    void RunSolveBenchmark()
+    {
+        FGraph Graph;
+
+        for (const std::int32_t Nodes : {10,100,1000,10000})
+        {
+            BuildChain(Graph,Nodes);
+
+            // solve about the same number of nodes for every size, so the time per node shows the scaling
+            const auto Iterations = Scaled(2000000 / Nodes);
+
+            char Name[64];
+            std::snprintf(Name,sizeof(Name),"chain of %d splitters",Nodes);
+            Measure(Name,Iterations,[&]()
+            {
+                std::int64_t Checksum = 0;
+                for (std::int64_t Iteration = 0 ; Iteration < Iterations ; ++Iteration)
+                {
+                    std::int32_t FailedNode;
+                    Checksum += static_cast<std::int64_t>(Graph.Solve(FailedNode));
+                    Checksum += Graph.AllocatedInputRate[Nodes - 1];
+                }
+                return Checksum;
+            });
+
+            std::printf("%-40s %10.2f ns/splitter\n","",LastNanoseconds / (static_cast<double>(Iterations) * Nodes));
+        }
+    }
+}
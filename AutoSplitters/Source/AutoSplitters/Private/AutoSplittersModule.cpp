@@ -1,4 +1,5 @@
 ﻿#include "AutoSplittersModule.h"
+#include "AutoSplittersStats.h"
 
 #include "Patching/NativeHookManager.h"
 
@@ -8,7 +9,9 @@
 #include "FGPlayerController.h"
 #include "FGBlueprintFunctionLibrary.h"
 #include "FGBuildableSubsystem.h"
+#include "Buildables/FGBuildableConveyorBase.h"
 #include "Buildables/MFGBuildableAutoSplitter.h"
+#include "Buildables/MFGBuildableWideAutoSplitter.h"
 #include "Hologram/MFGAutoSplitterHologram.h"
 #include "Engine/RendererSettings.h"
 #include "Subsystem/AutoSplittersSubsystem.h"
@@ -23,6 +26,17 @@ DEFINE_LOG_CATEGORY(LogGame)
 
 DEFINE_LOG_CATEGORY(LogAutoSplitters)
 
+DEFINE_STAT(STAT_AutoSplitters_FactoryTick);
+DEFINE_STAT(STAT_AutoSplitters_GrabOutput);
+DEFINE_STAT(STAT_AutoSplitters_SetupDistribution);
+DEFINE_STAT(STAT_AutoSplitters_PrepareCycle);
+DEFINE_STAT(STAT_AutoSplitters_BalanceNetwork);
+DEFINE_STAT(STAT_AutoSplitters_SolveNetwork);
+DEFINE_STAT(STAT_AutoSplitters_DiscoverHierarchy);
+DEFINE_STAT(STAT_AutoSplitters_BeltWalk);
+
+UE_TRACE_CHANNEL_DEFINE(AutoSplittersChannel);
+
 // #pragma optimize( "", off )
 
 void FAutoSplittersModule::OnSplitterLoadedFromSaveGame(AMFGBuildableAutoSplitter* Splitter)
@@ -71,8 +85,10 @@ void FAutoSplittersModule::ReplacePreComponentFixSplitters(UWorld* World, AAutoS
 		UE_LOG(LogAutoSplitters, Display, TEXT("Found building descriptor: %s"),
 		       *BuildingDescriptor->GetClass()->GetName());
 
-		if (UFGBuildingDescriptor::GetBuildableClass(BuildingDescriptor->GetClass())->IsChildOf(
-			AMFGBuildableAutoSplitter::StaticClass()))
+		// old splitters always had three outputs
+		const auto BuildableClass = UFGBuildingDescriptor::GetBuildableClass(BuildingDescriptor->GetClass());
+		if (BuildableClass->IsChildOf(AMFGBuildableAutoSplitter::StaticClass()) &&
+			!BuildableClass->IsChildOf(AMFGBuildableWideAutoSplitter::StaticClass()))
 		{
 			UE_LOG(LogAutoSplitters, Display, TEXT("Found AutoSplitter recipe to use for rebuilt splitters"));
 			AutoSplitterRecipe = Recipe;
@@ -215,6 +231,23 @@ void FAutoSplittersModule::StartupModule()
 	SUBSCRIBE_METHOD(IFGDismantleInterface::Execute_Upgrade,UpgradeHook);
 
 
+	// building or dismantling conveyors and factories changes the topology of the cached splitter networks
+	auto TopologyHook = [](AFGBuildableSubsystem* BuildableSubsystem, AFGBuildable* Buildable)
+	{
+		if (!Buildable || !BuildableSubsystem->HasAuthority())
+			return;
+
+		if (!Buildable->IsA<AFGBuildableConveyorBase>() && !Buildable->IsA<AFGBuildableFactory>())
+			return;
+
+		if (const auto AutoSplittersSubsystem = AAutoSplittersSubsystem::Get(BuildableSubsystem,false))
+			AutoSplittersSubsystem->InvalidateTopology();
+	};
+
+	SUBSCRIBE_METHOD_AFTER(AFGBuildableSubsystem::AddBuildable,TopologyHook);
+	SUBSCRIBE_METHOD_AFTER(AFGBuildableSubsystem::RemoveBuildable,TopologyHook);
+
+
 	auto NotifyBeginPlayHook = [&](AFGWorldSettings* WorldSettings)
 	{
 
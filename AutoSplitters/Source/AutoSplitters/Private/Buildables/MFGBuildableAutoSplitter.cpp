@@ -7,8 +7,15 @@
 
 #include "AutoSplittersLog.h"
 #include "AutoSplittersModule.h"
+#include "AutoSplittersStats.h"
 #include "FGFactoryConnectionComponent.h"
 #include "Buildables/FGBuildableConveyorBase.h"
+#include "EngineUtils.h"
+#include "HAL/IConsoleManager.h"
+#include "Async/Async.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Misc/ScopeExit.h"
 #include "Subsystem/AutoSplittersSubsystem.h"
 
 #if AUTO_SPLITTERS_DEBUG
@@ -36,6 +43,11 @@ constexpr auto MakeTArray(const T& Value) -> TArray<T,TFixedAllocator<n>>
     return Result;
 }
 
+FMFGBuildableAutoSplitterOutput::FMFGBuildableAutoSplitterOutput()
+    : State(ToBitfieldFlag(EOutputState::Automatic))
+    , Rate(0)
+{}
+
 FMFGBuildableAutoSplitterReplicatedProperties::FMFGBuildableAutoSplitterReplicatedProperties()
     : TransientState(0)
     , PersistentState(0) // Do the setup in BeginPlay(), otherwise we cannot detect version changes during loading
@@ -45,23 +57,34 @@ FMFGBuildableAutoSplitterReplicatedProperties::FMFGBuildableAutoSplitterReplicat
     , CachedInventoryItemCount(0)
     , ItemRate(0.0f)
 {
-    std::fill_n(OutputStates,NUM_OUTPUTS,ToBitfieldFlag(EOutputState::Automatic));
-    std::fill_n(OutputRates,NUM_OUTPUTS,ToBitfieldFlag(EOutputState::Automatic));
+    std::fill_n(OutputStates,LEGACY_OUTPUTS,ToBitfieldFlag(EOutputState::Automatic));
+    std::fill_n(OutputRates,LEGACY_OUTPUTS,ToBitfieldFlag(EOutputState::Automatic));
 }
 
+FAutoSplitterStatistics::FAutoSplitterStatistics()
+    : Splitters(0)
+    , PenalizedItems(0)
+    , BlockedTicks(0)
+    , CycleExtensions(0)
+    , CycleShortenings(0)
+    , CycleResets(0)
+    , BalanceRuns(0)
+    , InvalidBalanceRuns(0)
+{}
+
 AMFGBuildableAutoSplitter::AMFGBuildableAutoSplitter()
     : mDebug(false)
-    , mItemsPerCycle(make_array<NUM_OUTPUTS>(0))
-    , mBlockedFor(make_array<NUM_OUTPUTS>(0.0f))
-    , mAssignedItems(make_array<NUM_OUTPUTS>(0))
-    , mGrabbedItems(make_array<NUM_OUTPUTS>(0))
-    , mPriorityStepSize(make_array<NUM_OUTPUTS>(0.0f))
     , mBalancingRequired(true)
+    , mBalancingQueued(false)
     , mNeedsInitialDistributionSetup(true)
-    , mCycleTime(0.0f)
-    , mReallyGrabbed(0)
+    , mIsSleeping(false)
+    , mNetwork(nullptr)
+    , mNetworkNode(NO_NODE)
+    , mNetworkGeneration(0)
 {
-    std::fill_n(mLeftInCycleForOutputs,NUM_OUTPUTS,0);
+    std::fill_n(mLeftInCycleForOutputs,FMFGBuildableAutoSplitterReplicatedProperties::LEGACY_OUTPUTS,0);
+    mOutputConnections.fill(nullptr);
+    mStatistics.Splitters = 1;
 }
 
 void AMFGBuildableAutoSplitter::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const
@@ -75,25 +98,30 @@ void AMFGBuildableAutoSplitter::Factory_Tick(float dt)
     if (!HasAuthority())
         return;
 
+    AUTO_SPLITTERS_SCOPE(FactoryTick);
+
     // keep outputs from pulling while we're in here
-    mNextInventorySlot = make_array<NUM_OUTPUTS>(MAX_INVENTORY_SIZE);
+    mDistribution.LockOutputs();
 
     // skip direct splitter base class, it doesn't do anything useful for us
     AFGBuildableConveyorAttachment::Factory_Tick(dt);
 
-    if (DEBUG_THIS_SPLITTER)
+    if (PrepareTick(dt))
     {
-        UE_LOG(LogAutoSplitters,Display,TEXT("transient=%d persistent=%d cycleLength=%d leftInCycle=%d outputstates=(%d %d %d) remaining=(%d %d %d)"),
-            mReplicated.TransientState,mReplicated.PersistentState,
-            mReplicated.CycleLength,mReplicated.LeftInCycle,
-            mReplicated.OutputStates[0],mReplicated.OutputStates[1],mReplicated.OutputStates[2],
-            mLeftInCycleForOutputs[0],mLeftInCycleForOutputs[1],mLeftInCycleForOutputs[2]
-            );
-        UE_LOG(LogAutoSplitters,Display,TEXT("targetInput=%d outputRates=(%d %d %d) itemsPerCycle=(%d %d %d)"),
-            mReplicated.TargetInputRate,
-            mReplicated.OutputRates[0],mReplicated.OutputRates[1],mReplicated.OutputRates[2],
-            mItemsPerCycle[0],mItemsPerCycle[1],mItemsPerCycle[2]
-            );
+        TickDistribution(dt);
+    }
+}
+
+bool AMFGBuildableAutoSplitter::PrepareTick(float dt)
+{
+    if (mIsSleeping)
+    {
+        if (!ShouldWakeUp())
+        {
+            mDistribution.CycleTime += dt;
+            return false;
+        }
+        mIsSleeping = false;
     }
 
     if (mNeedsInitialDistributionSetup)
@@ -103,22 +131,25 @@ void AMFGBuildableAutoSplitter::Factory_Tick(float dt)
 
     if (mBalancingRequired)
     {
-        auto [valid,_] = Server_BalanceNetwork(this,true);
-        if (!valid)
+        // the subsystem balances every network with pending requests once per frame
+        if (!mBalancingQueued)
         {
-            // bail out for this tick
-            return;
+            AAutoSplittersSubsystem::Get(this)->RequestBalancing(this);
         }
+        // bail out for this tick
+        return false;
     }
 
-    for (int i = 0 ; i < NUM_OUTPUTS ; ++i)
+    return true;
+}
+
+void AMFGBuildableAutoSplitter::TickDistribution(float dt)
+{
+    mDistribution.BeginTick();
+    ON_SCOPE_EXIT
     {
-        mReplicated.LeftInCycle -= mGrabbedItems[i];
-        mGrabbedItems[i] = 0;
-        mAssignedItems[i] = 0;
-    }
-    mInventorySlotEnd = make_array<NUM_OUTPUTS>(0);
-    mAssignedOutputs = make_array<MAX_INVENTORY_SIZE>(-1);
+        UpdateReplicatedDistributionState();
+    };
 
     if (mReplicated.TargetInputRate == 0 && mInputs[0]->IsConnected())
     {
@@ -128,9 +159,9 @@ void AMFGBuildableAutoSplitter::Factory_Tick(float dt)
 
     int32 Connections = 0;
     bool NeedsBalancing = false;
-    for (int32 i = 0 ; i < NUM_OUTPUTS ; ++i)
+    for (int32 i = 0 ; i < GetNumOutputs() ; ++i)
     {
-        const bool Connected = IsSet(mReplicated.OutputStates[i],EOutputState::Connected);
+        const bool Connected = IsSet(mReplicated.Outputs[i].State,EOutputState::Connected);
         Connections += Connected;
         if (Connected != mOutputs[i]->IsConnected())
         {
@@ -144,6 +175,8 @@ void AMFGBuildableAutoSplitter::Factory_Tick(float dt)
 
     if (NeedsBalancing)
     {
+        // not all connection changes go through the buildable subsystem
+        AAutoSplittersSubsystem::Get(this)->InvalidateTopology();
         mBalancingRequired = true;
         // bail out for this tick
         return;
@@ -154,134 +187,52 @@ void AMFGBuildableAutoSplitter::Factory_Tick(float dt)
         SetupDistribution();
     }
 
-    mReplicated.CachedInventoryItemCount = 0;
-    auto PopulatedInventorySlots = make_array<MAX_INVENTORY_SIZE>(-1);
-    for (int32 i = 0 ; i < mInventorySizeX ; ++i)
-    {
-        if(mBufferInventory->IsSomethingOnIndex(i))
-        {
-            PopulatedInventorySlots[mReplicated.CachedInventoryItemCount++] = i;
-        }
-    }
+    // the distribution hands out buffer slots, which stay put when new items arrive before the outputs grab them
+    std::array<int32,MAX_INVENTORY_SIZE> PopulatedSlots;
+    mReplicated.CachedInventoryItemCount = mItemBuffer.GetOccupiedSlots(PopulatedSlots.data());
 
     if (Connections == 0 || mReplicated.CachedInventoryItemCount == 0)
     {
-        mCycleTime += dt;
+        // nothing to do until an item arrives or the configuration changes
+        mIsSleeping = true;
+        mTrace.Record(EAutoSplitterTraceEvent::Sleep,mReplicated.CachedInventoryItemCount);
+        mDistribution.CycleTime += dt;
         return;
     }
 
-    if (mReplicated.LeftInCycle < -40)
+    if (mDistribution.UsesTokenBuckets())
+    {
+        // there are no cycles to maintain, only refresh the item rate every now and then
+        if (mDistribution.CycleTime >= FAutoSplitterDistribution::MIN_CYCLE_TIME)
+        {
+            PrepareCycle(false);
+        }
+    }
+    else if (mDistribution.NeedsCycleReset())
     {
-        UE_LOG(LogAutoSplitters,Warning,TEXT("mLeftInCycle too negative (%d), resetting"),mReplicated.LeftInCycle);
+        UE_LOG(LogAutoSplitters,Verbose,TEXT("mLeftInCycle too negative (%d), resetting"),mDistribution.LeftInCycle);
+        mTrace.Record(EAutoSplitterTraceEvent::CycleReset,mDistribution.LeftInCycle);
+        ++mStatistics.CycleResets;
         PrepareCycle(false,true);
     }
-    else if (mReplicated.LeftInCycle <= 0)
+    else if (mDistribution.LeftInCycle <= 0)
     {
         PrepareCycle(true);
     }
 
-    mCycleTime += dt;
-    auto AssignableItems = make_array<NUM_OUTPUTS>(0);
-
-    auto NextInventorySlot = make_array<NUM_OUTPUTS>(MAX_INVENTORY_SIZE);
-
-    for (int32 ActiveSlot = 0 ; ActiveSlot < mReplicated.CachedInventoryItemCount ; ++ActiveSlot)
-    {
-        if (DEBUG_THIS_SPLITTER)
-        {
-            UE_LOG(LogAutoSplitters,Display,TEXT("slot=%d"),ActiveSlot);
-        }
-        int32 Next = -1;
-        float Priority = -INFINITY;
-        for (int32 i = 0; i < NUM_OUTPUTS; ++i)
-        {
-            // Adding the grabbed items in the next line de-skews the algorithm if the output has been
-            // penalized for an earlier inventory slot
-            AssignableItems[i] = mLeftInCycleForOutputs[i] - mAssignedItems[i] + mGrabbedItems[i];
-            const auto ItemPriority = AssignableItems[i] * mPriorityStepSize[i];
-            if (AssignableItems[i] > 0 && ItemPriority > Priority)
-            {
-                Next = i;
-                Priority = ItemPriority;
-            }
-        }
-
-        if (Next < 0)
-        {
-            break;
-        }
-
-        std::array<bool,NUM_OUTPUTS> Penalized = {false,false,false};
-        while (IsOutputBlocked(Next) && Next >= 0)
-        {
-            if (DEBUG_THIS_SPLITTER)
-            {
-                UE_LOG(LogAutoSplitters,Display,TEXT("Output %d is blocked, reassigning item and penalizing output"),Next);
-            }
-            Penalized[Next] = true;
-            --mLeftInCycleForOutputs[Next];
-            ++mAssignedItems[Next];
-            ++mGrabbedItems[Next]; // this is a blatant lie, but it will cause the correct update of mLeftInCycle during the next tick
-            --AssignableItems[Next];
-            Priority = -INFINITY;
-            Next = -1;
-            for (int32 i = 0 ; i < NUM_OUTPUTS ; ++i)
-            {
-                if (Penalized[i] || AssignableItems[i] <= 0)
-                    continue;
-
-                const auto ItemPriority = AssignableItems[i] * mPriorityStepSize[i];
-                if (ItemPriority > Priority)
-                {
-                    Next = i;
-                    Priority = ItemPriority;
-                }
-            }
-        }
-
-        if (Next >= 0)
-        {
-            const auto Slot = PopulatedInventorySlots[ActiveSlot];
-            if (DEBUG_THIS_SPLITTER)
-            {
-                UE_LOG(LogAutoSplitters,Display,TEXT("Slot %d -> actual slot %d"),ActiveSlot,Slot);
-            }
-            mAssignedOutputs[Slot] = Next;
-            if (NextInventorySlot[Next] == MAX_INVENTORY_SIZE)
-                NextInventorySlot[Next] = Slot;
-            mInventorySlotEnd[Next] = Slot + 1;
-            ++mAssignedItems[Next];
-        }
-        else if (DEBUG_THIS_SPLITTER) {
-            UE_LOG(LogAutoSplitters,Warning,TEXT("All eligible outputs blocked, cannot assign item!"))
-        }
-
-    }
+    mDistribution.CycleTime += dt;
 
-    for (int32 i = 0 ; i < NUM_OUTPUTS ; ++i)
-    {
-        // Checking for mGrabbedItems seems weird, but that catches stuck outputs
-        // that have been penalized
-        if ((mAssignedItems[i] > 0 || mGrabbedItems[i] > 0))
-        {
-            mBlockedFor[i] += dt;
-        }
-    }
+    const auto Unassigned = mDistribution.AssignItems(PopulatedSlots.data(),mReplicated.CachedInventoryItemCount,dt);
+    mStatistics.PenalizedItems += mDistribution.PenalizedItems;
 
-    if (DEBUG_THIS_SPLITTER)
+    mTrace.RecordOutputs(EAutoSplitterTraceEvent::Assign,mDistribution.AssignedItems,GetNumOutputs());
+    if (Unassigned > 0)
     {
-        UE_LOG(LogAutoSplitters,Display,TEXT("Assigned items (jammed): 0=%d (%f) 1=%d (%f) 2=%d (%f)"),
-            mAssignedItems[0],mBlockedFor[0],
-            mAssignedItems[1],mBlockedFor[1],
-            mAssignedItems[2],mBlockedFor[2]
-            );
+        mTrace.Record(EAutoSplitterTraceEvent::Blocked,Unassigned,mDistribution.LeftInCycle);
+        ++mStatistics.BlockedTicks;
     }
-
-    // make new items available to outputs
-    mNextInventorySlot = NextInventorySlot;
 }
 
-
 void AMFGBuildableAutoSplitter::PostLoadGame_Implementation(int32 saveVersion, int32 gameVersion)
 {
     Super::PostLoadGame_Implementation(saveVersion,gameVersion);
@@ -305,6 +256,89 @@ void AMFGBuildableAutoSplitter::PostLoadGame_Implementation(int32 saveVersion, i
     FAutoSplittersModule::Get()->OnSplitterLoadedFromSaveGame(this);
 }
 
+void AMFGBuildableAutoSplitter::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+    // cached networks must not keep pointers to this splitter
+    if (HasAuthority() && EndPlayReason == EEndPlayReason::Destroyed)
+    {
+        if (const auto AutoSplittersSubsystem = AAutoSplittersSubsystem::Get(this,false))
+            AutoSplittersSubsystem->InvalidateTopology();
+    }
+    Super::EndPlay(EndPlayReason);
+}
+
+void AMFGBuildableAutoSplitter::PreSaveGame_Implementation(int32 saveVersion, int32 gameVersion)
+{
+    Super::PreSaveGame_Implementation(saveVersion,gameVersion);
+
+    CopyItemBufferToBufferInventory();
+
+    // make sure items handed out since the last tick are reflected in the saved cycle
+    mDistribution.CommitGrabs();
+
+    for (int32 i = 0 ; i < mOutputsLeftInCycle.Num() ; ++i)
+    {
+        mOutputsLeftInCycle[i] = mDistribution.LeftInCycleForOutputs[i];
+    }
+}
+
+void AMFGBuildableAutoSplitter::PostSaveGame_Implementation(int32 saveVersion, int32 gameVersion)
+{
+    Super::PostSaveGame_Implementation(saveVersion,gameVersion);
+
+    // the items only live in the item buffer while the game is running
+    if (HasAuthority())
+        mBufferInventory->Empty();
+}
+
+void AMFGBuildableAutoSplitter::GetDismantleInventoryReturns(TArray<FInventoryStack>& out_returns) const
+{
+    Super::GetDismantleInventoryReturns(out_returns);
+
+    mItemBuffer.ForEach([&](const FInventoryItem& Item)
+    {
+        FInventoryStack Stack;
+        Stack.NumItems = 1;
+        Stack.Item = Item;
+        out_returns.Add(Stack);
+    });
+}
+
+void AMFGBuildableAutoSplitter::SetupItemBuffer()
+{
+    mItemBuffer.SetSize(std::min(mInventorySizeX,MAX_INVENTORY_SIZE));
+    MoveBufferInventoryToItemBuffer();
+}
+
+void AMFGBuildableAutoSplitter::MoveBufferInventoryToItemBuffer()
+{
+    for (int32 i = 0 ; i < mBufferInventory->GetSizeLinear() && !mItemBuffer.IsFull() ; ++i)
+    {
+        FInventoryStack Stack;
+        if (mBufferInventory->GetStackFromIndex(i,Stack) && Stack.HasItems())
+        {
+            for (int32 Item = 0 ; Item < Stack.NumItems && !mItemBuffer.IsFull() ; ++Item)
+            {
+                mItemBuffer.Push(Stack.Item);
+            }
+        }
+    }
+    mBufferInventory->Empty();
+}
+
+void AMFGBuildableAutoSplitter::CopyItemBufferToBufferInventory()
+{
+    mBufferInventory->Empty();
+    int32 Index = 0;
+    mItemBuffer.ForEach([&](const FInventoryItem& Item)
+    {
+        FInventoryStack Stack;
+        Stack.NumItems = 1;
+        Stack.Item = Item;
+        mBufferInventory->AddStackToIndex(Index++,Stack);
+    });
+}
+
 UClass* AMFGBuildableAutoSplitter::GetReplicationDetailActorClass() const
 {
     return Super::GetReplicationDetailActorClass();
@@ -318,12 +352,15 @@ void AMFGBuildableAutoSplitter::BeginPlay()
     {
         if (IsSplitterFlagSet(ETransient::NeedsLoadedSplitterProcessing))
         {
+            SizeOutputArrays();
 
             // special case for really old and broken splitters created with 0.2.0 and older
             if (IsSplitterFlagSet(EPersistent::NeedsConnectionsFixup))
             {
                 FixupConnections();
                 Super::BeginPlay();
+                CacheOutputConnections();
+                SetupItemBuffer();
                 return;
             }
 
@@ -350,6 +387,17 @@ void AMFGBuildableAutoSplitter::BeginPlay()
 #endif
                 }
             case EAutoSplittersSerializationVersion::NestedReplicationStruct:
+                {
+                    UE_LOG(LogAutoSplitters,Display,TEXT("%s: Upgrading to PerOutputArrays"),*GetName());
+                    const auto LegacyOutputs = FMath::Min(GetNumOutputs(),FMFGBuildableAutoSplitterReplicatedProperties::LEGACY_OUTPUTS);
+                    for (int32 i = 0 ; i < LegacyOutputs ; ++i)
+                    {
+                        mReplicated.Outputs[i].State = mReplicated.OutputStates[i];
+                        mReplicated.Outputs[i].Rate = mReplicated.OutputRates[i];
+                        mOutputsLeftInCycle[i] = mLeftInCycleForOutputs[i];
+                    }
+                }
+            case EAutoSplittersSerializationVersion::PerOutputArrays:
                 break;
             default:
                 {
@@ -358,19 +406,32 @@ void AMFGBuildableAutoSplitter::BeginPlay()
                 }
             }
 
-            mReplicated.LeftInCycle = std::accumulate(mLeftInCycleForOutputs,mLeftInCycleForOutputs + NUM_OUTPUTS,0);
-            mReplicated.CycleLength = std::accumulate(mItemsPerCycle.begin(),mItemsPerCycle.end(),0);
-            mCycleTime = -100000.0; // this delays item rate calculation to the first full cycle when loading the game
+            for (int32 i = 0 ; i < mOutputsLeftInCycle.Num() ; ++i)
+            {
+                mDistribution.LeftInCycleForOutputs[i] = mOutputsLeftInCycle[i];
+            }
+            mDistribution.LeftInCycle = std::accumulate(mOutputsLeftInCycle.GetData(),mOutputsLeftInCycle.GetData() + mOutputsLeftInCycle.Num(),0);
+            mDistribution.CycleLength = std::accumulate(mDistribution.ItemsPerCycle.begin(),mDistribution.ItemsPerCycle.end(),0);
+            mDistribution.CycleTime = -100000.0f; // this delays item rate calculation to the first full cycle when loading the game
 
             SetupDistribution(true);
+            UpdateReplicatedDistributionState();
             mNeedsInitialDistributionSetup = false;
             ClearSplitterFlag(ETransient::NeedsLoadedSplitterProcessing);
 
         }
 
         Super::BeginPlay();
+        if (mOutputs.Num() > MAX_OUTPUTS)
+        {
+            UE_LOG(LogAutoSplitters,Error,TEXT("%s has %d outputs, only the first %d will be used"),*GetName(),mOutputs.Num(),MAX_OUTPUTS);
+        }
+        CacheOutputConnections();
+        SizeOutputArrays();
         SetSplitterVersion(VERSION);
+        AAutoSplittersSubsystem::Get(this)->InvalidateTopology();
         mBalancingRequired = true;
+        SetupItemBuffer();
     }
     else
     {
@@ -379,6 +440,50 @@ void AMFGBuildableAutoSplitter::BeginPlay()
 }
 
 
+void AMFGBuildableAutoSplitter::Factory_CollectInput_Implementation()
+{
+    // pull directly into the item buffer, this avoids all the inventory component overhead and event broadcasts
+    if (!HasAuthority() || !mInputs[0]->IsConnected())
+        return;
+
+    FInventoryItem Item;
+    float OffsetBeyond;
+    while (!mItemBuffer.IsFull() && mInputs[0]->Factory_GrabOutput(Item,OffsetBeyond))
+    {
+        mItemBuffer.Push(MoveTemp(Item));
+        mIsSleeping = false;
+    }
+}
+
+bool AMFGBuildableAutoSplitter::ShouldWakeUp() const
+{
+    // settings changes and rebalancing always end up in one of these flags
+    if (mBalancingRequired || mNeedsInitialDistributionSetup || IsSplitterFlagSet(EPersistent::NeedsDistributionSetup))
+        return true;
+
+    for (int32 i = 0 ; i < GetNumOutputs() ; ++i)
+    {
+        if (IsSet(mReplicated.Outputs[i].State,EOutputState::Connected) != mOutputs[i]->IsConnected())
+            return true;
+    }
+
+    return false;
+}
+
+void AMFGBuildableAutoSplitter::CacheOutputConnections()
+{
+    for (int32 i = 0 ; i < MAX_OUTPUTS ; ++i)
+    {
+        mOutputConnections[i] = mOutputs.IsValidIndex(i) ? mOutputs[i] : nullptr;
+    }
+}
+
+void AMFGBuildableAutoSplitter::SizeOutputArrays()
+{
+    mReplicated.Outputs.SetNum(GetNumOutputs());
+    mOutputsLeftInCycle.SetNumZeroed(GetNumOutputs());
+}
+
 void AMFGBuildableAutoSplitter::FillDistributionTable(float dt)
 {
     // we are doing our own distribution management, as we need to track
@@ -393,62 +498,26 @@ bool AMFGBuildableAutoSplitter::Factory_GrabOutput_Implementation(UFGFactoryConn
         UE_LOG(LogAutoSplitters, Fatal, TEXT("Factory_GrabOutput_Implementation() was called without authority"));
     }
 
-    int32 Output = -1;
-    for (int32 i = 0 ; i < NUM_OUTPUTS ; ++i)
-    {
-        if (connection == mOutputs[i])
-        {
-            Output = i;
-            break;
-        }
-    }
+    AUTO_SPLITTERS_SCOPE(GrabOutput);
+
+    const int32 Output = FindOutputIndex(connection);
     if (Output < 0)
     {
         UE_LOG(LogAutoSplitters,Error,TEXT("Could not find connection!"));
         return false;
     }
 
-    mBlockedFor[Output] = 0.0;
-
-    if (mAssignedItems[Output] <= mGrabbedItems[Output])
-    {
-        if (!IsSet(mReplicated.OutputStates[Output],EOutputState::Connected))
-        {
-            mBalancingRequired = true;
-        }
-        return false;
-    }
+    const auto OffsetBeyond = mDistribution.GrabbedItems[Output] * AFGBuildableConveyorBase::ITEM_SPACING;
+    const auto Slot = mDistribution.GrabItem(Output);
 
-    for(int32 Slot = mNextInventorySlot[Output] ; Slot < mInventorySlotEnd[Output] ; ++Slot)
+    if (Slot >= 0)
     {
-        if (mAssignedOutputs[Slot] == Output)
-        {
-            if (Slot > 8)
-            {
-                UE_LOG(LogAutoSplitters,Error,TEXT("Hit invalid slot %d for output %d"),Slot,Output);
-            }
-            FInventoryStack Stack;
-            mBufferInventory->GetStackFromIndex(Slot,Stack);
-            mBufferInventory->RemoveAllFromIndex(Slot);
-            out_item = Stack.Item;
-            out_OffsetBeyond = mGrabbedItems[Output] * AFGBuildableConveyorBase::ITEM_SPACING;
-            ++mGrabbedItems[Output];
-            --mLeftInCycleForOutputs[Output];
-            ++mReallyGrabbed;
-            mNextInventorySlot[Output] = Slot + 1;
-
-            if (DEBUG_THIS_SPLITTER)
-            {
-                UE_LOG(LogAutoSplitters,Display,TEXT("Sent item out of output %d"),Output);
-            }
-
-            return true;
-        }
+        out_item = mItemBuffer.Take(Slot);
+        out_OffsetBeyond = OffsetBeyond;
+        return true;
     }
 
-    UE_LOG(LogAutoSplitters,Warning,TEXT("Output %d: No valid output found, this should not happen!"),Output);
-
-    if (!IsSet(mReplicated.OutputStates[Output],EOutputState::Connected))
+    if (!IsSet(mReplicated.Outputs[Output].State,EOutputState::Connected))
     {
         mBalancingRequired = true;
     }
@@ -458,190 +527,86 @@ bool AMFGBuildableAutoSplitter::Factory_GrabOutput_Implementation(UFGFactoryConn
 
 void AMFGBuildableAutoSplitter::SetupDistribution(bool LoadingSave)
 {
+    AUTO_SPLITTERS_SCOPE(SetupDistribution);
+
+    const auto OutputRates = GatherOutputs(&FMFGBuildableAutoSplitterOutput::Rate);
 
     if (DEBUG_THIS_SPLITTER)
     {
         UE_LOG(
             LogAutoSplitters,
             Display,
-            TEXT("SetupDistribution() input=%d outputs=(%d %d %d)"),
+            TEXT("SetupDistribution() input=%d outputs=(%s)"),
             mReplicated.TargetInputRate,
-            mReplicated.OutputRates[0],
-            mReplicated.OutputRates[1],
-            mReplicated.OutputRates[2]
+            *FormatOutputs(OutputRates)
             );
     }
 
     if (!LoadingSave)
     {
-        for (int32 i = 0 ; i < NUM_OUTPUTS ; ++i)
+        for (int32 i = 0 ; i < GetNumOutputs() ; ++i)
         {
-            mReplicated.OutputStates[i] = SetFlag(mReplicated.OutputStates[i],EOutputState::Connected,mOutputs[i]->IsConnected());
+            mReplicated.Outputs[i].State = SetFlag(mReplicated.Outputs[i].State,EOutputState::Connected,mOutputs[i]->IsConnected());
         }
     }
 
-    if (std::none_of(mReplicated.OutputStates,mReplicated.OutputStates+NUM_OUTPUTS,[](auto State) { return IsSet(State,EOutputState::Connected); }))
-    {
-        std::fill_n(mReplicated.OutputRates,NUM_OUTPUTS,FRACTIONAL_RATE_MULTIPLIER);
-        std::fill_n(mItemsPerCycle.begin(),NUM_OUTPUTS,0);
-        return;
-    }
-
-    // calculate item counts per cycle
-    for (int32 i = 0 ; i < NUM_OUTPUTS ; ++i)
+    uint32 ConnectedOutputs = 0;
+    for (int32 i = 0 ; i < GetNumOutputs() ; ++i)
     {
-        mItemsPerCycle[i] = IsSet(mReplicated.OutputStates[i], EOutputState::Connected) * mReplicated.OutputRates[i];
+        if (IsSet(mReplicated.Outputs[i].State,EOutputState::Connected))
+            ConnectedOutputs |= 1u << i;
     }
 
-#if UE_BUILD_SHIPPING
-    const auto GCD = std::accumulate(
-        mItemsPerCycle.begin()+1,
-        mItemsPerCycle.end(),
-        mItemsPerCycle[0],
-        [](auto a, auto b) { return std::gcd(a,b);}
-        );
-#else
-    // The checked iterator generated here for begin() cannot be advanced with +1, we don't care, this code won't ever
-    // run anyway
-    const auto GCD = std::accumulate(
-        mItemsPerCycle.begin(),
-        mItemsPerCycle.end(),
-        mItemsPerCycle[0],
-        [](auto a, auto b) { return std::gcd(a,b);}
-        );
-#endif
+    mDistribution.Mode = IsSplitterFlagSet(EPersistent::TokenBucketDistribution)
+        ? FAutoSplitterDistribution::EMode::TokenBuckets
+        : FAutoSplitterDistribution::EMode::Cycles;
 
-    if (GCD == 0)
-    {
-        if (DEBUG_THIS_SPLITTER)
-        {
-            UE_LOG(LogAutoSplitters,Display,TEXT("Nothing connected, chilling"));
-        }
-        return;
-    }
+    const auto Result = mDistribution.Setup(ConnectedOutputs,OutputRates.data(),LoadingSave);
 
-    for (auto& Item : mItemsPerCycle)
-        Item /= GCD;
+    // Every outcome is final until the connections or the rates change, which requests another setup. Leaving the
+    // flag set would keep waking up splitters that have nothing to do.
+    ClearSplitterFlag(EPersistent::NeedsDistributionSetup);
 
-    mReplicated.CycleLength = 0;
-    bool Changed = false;
-    for (int32 i = 0 ; i < NUM_OUTPUTS ; ++i)
+    switch (Result)
     {
-        if (IsSet(mReplicated.OutputStates[i],EOutputState::Connected))
+    case FAutoSplitterDistribution::ESetupResult::NothingConnected:
+        for (auto& Output : mReplicated.Outputs)
         {
-            mReplicated.CycleLength += mItemsPerCycle[i];
-            float StepSize = 0.0f;
-            if (mItemsPerCycle[i] > 0)
-            {
-                StepSize = 1.0f/mItemsPerCycle[i];
-            }
-            if (mPriorityStepSize[i] != StepSize)
-            {
-                mPriorityStepSize[i] = StepSize;
-                Changed = true;
-            }
+            Output.Rate = FRACTIONAL_RATE_MULTIPLIER;
         }
-        else
+        return;
+    case FAutoSplitterDistribution::ESetupResult::NothingToDistribute:
+        if (DEBUG_THIS_SPLITTER)
         {
-            // disable output
-            if (mPriorityStepSize[i] != 0)
-            {
-                mPriorityStepSize[i] = 0;
-                Changed = true;
-            }
+            UE_LOG(LogAutoSplitters,Display,TEXT("Nothing connected, chilling"));
         }
+        return;
+    case FAutoSplitterDistribution::ESetupResult::Ready:
+        break;
     }
 
-    if (Changed && !LoadingSave)
-    {
-        std::fill_n(mLeftInCycleForOutputs,NUM_OUTPUTS,0);
-        mReplicated.LeftInCycle = 0;
-        PrepareCycle(false);
-    }
-
-    ClearSplitterFlag(EPersistent::NeedsDistributionSetup);
+    mTrace.RecordOutputs(EAutoSplitterTraceEvent::Setup,mDistribution.ItemsPerCycle,GetNumOutputs());
+    UpdateReplicatedDistributionState();
 }
 
 void AMFGBuildableAutoSplitter::PrepareCycle(const bool AllowCycleExtension, const bool Reset)
 {
-    if (DEBUG_THIS_SPLITTER)
-    {
-        UE_LOG(LogAutoSplitters,Display,TEXT("PrepareCycle(%s,%s) cycleTime=%f grabbed=%d"),
-            AllowCycleExtension ? TEXT("true") : TEXT("false"),
-            Reset ? TEXT("true") : TEXT("false"),
-            mCycleTime,
-            mReallyGrabbed
-            );
-    }
-
-    if (!Reset && mCycleTime > 0.0)
-    {
-        // update statistics
-        if (mReplicated.ItemRate > 0.0)
-        {
-            mReplicated.ItemRate = EXPONENTIAL_AVERAGE_WEIGHT * 60 * mReallyGrabbed / mCycleTime + (1.0-EXPONENTIAL_AVERAGE_WEIGHT) * mReplicated.ItemRate;
-        }
-        else
-        {
-            // bootstrap
-            mReplicated.ItemRate = 60.0 * mReallyGrabbed / mCycleTime;
-        }
-
-        if (AllowCycleExtension && mCycleTime < 2.0)
-        {
-            if (DEBUG_THIS_SPLITTER)
-            {
-                UE_LOG(LogAutoSplitters,Display,TEXT("Cycle time too short (%f), doubling cycle length to %d"),mCycleTime,2*mReplicated.CycleLength);
-            }
-            mReplicated.CycleLength *= 2;
-            for (int i = 0 ; i < NUM_OUTPUTS ; ++i)
-                mItemsPerCycle[i] *= 2;
-        }
-        else if (mCycleTime > 10.0)
-        {
-            bool CanShortenCycle = !(mReplicated.CycleLength & 1);
-            for (int i = 0 ; i < NUM_OUTPUTS ; ++i)
-                CanShortenCycle = CanShortenCycle && !(mItemsPerCycle[i] & 1);
-
-            if (CanShortenCycle)
-            {
-                if (DEBUG_THIS_SPLITTER)
-                {
-                    UE_LOG(LogAutoSplitters,Display,TEXT("Cycle time too long (%f), halving cycle length to %d"),mCycleTime,mReplicated.CycleLength/2);
-                }
-                mReplicated.CycleLength /= 2;
-                for (int i = 0 ; i < NUM_OUTPUTS ; ++i)
-                    mItemsPerCycle[i] /= 2;
-            }
-        }
-    }
+    AUTO_SPLITTERS_SCOPE(PrepareCycle);
 
-    mCycleTime = 0.0;
-    mReallyGrabbed = 0;
+    const auto CycleTime = mDistribution.CycleTime;
 
-    if (Reset)
+    switch (mDistribution.PrepareCycle(AllowCycleExtension,Reset))
     {
-        mReplicated.LeftInCycle = mReplicated.CycleLength;
-
-        for (int i = 0; i < NUM_OUTPUTS ; ++i)
-        {
-            if (IsSet(mReplicated.OutputStates[i],EOutputState::Connected) && mReplicated.OutputRates[i] > 0)
-                mLeftInCycleForOutputs[i] = mItemsPerCycle[i];
-            else
-                mLeftInCycleForOutputs[i] = 0;
-        }
-    }
-    else
-    {
-        mReplicated.LeftInCycle += mReplicated.CycleLength;
-
-        for (int i = 0; i < NUM_OUTPUTS ; ++i)
-        {
-            if (IsSet(mReplicated.OutputStates[i],EOutputState::Connected) && mReplicated.OutputRates[i] > 0)
-                mLeftInCycleForOutputs[i] += mItemsPerCycle[i];
-            else
-                mLeftInCycleForOutputs[i] = 0;
-        }
+    case FAutoSplitterDistribution::ECycleAdjustment::Extended:
+        mTrace.Record(EAutoSplitterTraceEvent::CycleExtended,mDistribution.CycleLength,static_cast<int32>(CycleTime * 1000));
+        ++mStatistics.CycleExtensions;
+        break;
+    case FAutoSplitterDistribution::ECycleAdjustment::Shortened:
+        mTrace.Record(EAutoSplitterTraceEvent::CycleShortened,mDistribution.CycleLength,static_cast<int32>(CycleTime * 1000));
+        ++mStatistics.CycleShortenings;
+        break;
+    case FAutoSplitterDistribution::ECycleAdjustment::None:
+        break;
     }
 }
 
@@ -674,7 +639,7 @@ bool AMFGBuildableAutoSplitter::Server_SetTargetRateAutomatic(bool Automatic)
         return true;
 
     SetSplitterFlag(EPersistent::ManualInputRate,!Automatic);
-    auto [valid, _] = Server_BalanceNetwork(this);
+    auto [valid, _] = Server_RebalanceNetwork(this);
     if (!valid)
     {
         SetSplitterFlag(EPersistent::ManualInputRate,Automatic);
@@ -684,6 +649,18 @@ bool AMFGBuildableAutoSplitter::Server_SetTargetRateAutomatic(bool Automatic)
     return true;
 }
 
+bool AMFGBuildableAutoSplitter::Server_SetTokenBucketDistribution(bool Enabled)
+{
+    if (Enabled == IsSplitterFlagSet(EPersistent::TokenBucketDistribution))
+        return true;
+
+    // the rates stay the same, so there is no need to rebalance
+    SetSplitterFlag(EPersistent::TokenBucketDistribution,Enabled);
+    SetSplitterFlag(EPersistent::NeedsDistributionSetup);
+    OnStateChangedEvent.Broadcast(this);
+    return true;
+}
+
 float AMFGBuildableAutoSplitter::GetTargetInputRate() const
 {
     return mReplicated.TargetInputRate * INV_FRACTIONAL_RATE_MULTIPLIER;
@@ -703,7 +680,7 @@ bool AMFGBuildableAutoSplitter::Server_SetTargetInputRate(float Rate)
     mReplicated.TargetInputRate = IntRate;
 
     if (Changed)
-        Server_BalanceNetwork(this);
+        Server_RebalanceNetwork(this);
 
     OnStateChangedEvent.Broadcast(this);
     return true;
@@ -711,15 +688,15 @@ bool AMFGBuildableAutoSplitter::Server_SetTargetInputRate(float Rate)
 
 float AMFGBuildableAutoSplitter::GetOutputRate(int32 Output) const
 {
-    if (Output < 0 || Output > NUM_OUTPUTS -1)
+    if (!mReplicated.Outputs.IsValidIndex(Output))
         return NAN;
 
-    return static_cast<float>(mReplicated.OutputRates[Output]) * INV_FRACTIONAL_RATE_MULTIPLIER;
+    return static_cast<float>(mReplicated.Outputs[Output].Rate) * INV_FRACTIONAL_RATE_MULTIPLIER;
 }
 
 bool AMFGBuildableAutoSplitter::Server_SetOutputRate(const int32 Output, const float Rate)
 {
-    if (Output < 0 || Output > NUM_OUTPUTS - 1)
+    if (Output < 0 || Output >= GetNumOutputs())
     {
         UE_LOG(
             LogAutoSplitters,
@@ -743,7 +720,7 @@ bool AMFGBuildableAutoSplitter::Server_SetOutputRate(const int32 Output, const f
         return false;
     }
 
-    if (IsSet(mReplicated.OutputStates[Output],EOutputState::Automatic))
+    if (IsSet(mReplicated.Outputs[Output].State,EOutputState::Automatic))
     {
         UE_LOG(
             LogAutoSplitters,
@@ -754,11 +731,11 @@ bool AMFGBuildableAutoSplitter::Server_SetOutputRate(const int32 Output, const f
         return false;
     }
 
-    if (mReplicated.OutputRates[Output] == Rate)
+    if (mReplicated.Outputs[Output].Rate == Rate)
         return true;
 
-    int32 OldRate = mReplicated.OutputRates[Output];
-    mReplicated.OutputRates[Output] = IntRate;
+    int32 OldRate = mReplicated.Outputs[Output].Rate;
+    mReplicated.Outputs[Output].Rate = IntRate;
 
     auto [DownstreamAutoSplitter,_,Ready] = FindAutoSplitterAndMaxBeltRate(mOutputs[Output],true);
 
@@ -772,11 +749,11 @@ bool AMFGBuildableAutoSplitter::Server_SetOutputRate(const int32 Output, const f
         DownstreamAutoSplitter->mReplicated.TargetInputRate = IntRate;
     }
 
-    auto [valid,_2] = Server_BalanceNetwork(this);
+    auto [valid,_2] = Server_RebalanceNetwork(this);
 
     if (!valid)
     {
-        mReplicated.OutputRates[Output] = OldRate;
+        mReplicated.Outputs[Output].Rate = OldRate;
         if (DownstreamAutoSplitter)
         {
             DownstreamAutoSplitter->SetSplitterFlag(EPersistent::ManualInputRate,OldManualInputRate);
@@ -791,10 +768,10 @@ bool AMFGBuildableAutoSplitter::Server_SetOutputRate(const int32 Output, const f
 bool AMFGBuildableAutoSplitter::Server_SetOutputAutomatic(int32 Output, bool Automatic)
 {
 
-    if (Output < 0 || Output > NUM_OUTPUTS - 1)
+    if (Output < 0 || Output >= GetNumOutputs())
         return false;
 
-    if (Automatic == IsSet(mReplicated.OutputStates[Output],EOutputState::Automatic))
+    if (Automatic == IsSet(mReplicated.Outputs[Output].State,EOutputState::Automatic))
         return true;
 
     auto [DownstreamAutoSplitter,_,Ready] = FindAutoSplitterAndMaxBeltRate(mOutputs[Output],true);
@@ -804,13 +781,13 @@ bool AMFGBuildableAutoSplitter::Server_SetOutputAutomatic(int32 Output, bool Aut
     }
     else
     {
-        mReplicated.OutputStates[Output] = SetFlag(mReplicated.OutputStates[Output],EOutputState::Automatic,Automatic);
+        mReplicated.Outputs[Output].State = SetFlag(mReplicated.Outputs[Output].State,EOutputState::Automatic,Automatic);
     }
 
-    auto [valid,_2] = Server_BalanceNetwork(this);
+    auto [valid,_2] = Server_RebalanceNetwork(this);
     if (!valid)
     {
-        mReplicated.OutputStates[Output] = SetFlag(mReplicated.OutputStates[Output], EOutputState::Automatic,!Automatic);
+        mReplicated.Outputs[Output].State = SetFlag(mReplicated.Outputs[Output].State, EOutputState::Automatic,!Automatic);
         if (DownstreamAutoSplitter)
         {
             DownstreamAutoSplitter->SetSplitterFlag(EPersistent::ManualInputRate,Automatic);
@@ -959,20 +936,20 @@ void AMFGBuildableAutoSplitter::SetupInitialDistributionState()
 {
     auto [InputSplitter,MaxInputRate,Ready] = FindAutoSplitterAndMaxBeltRate(mInputs[0], false);
     mReplicated.TargetInputRate = MaxInputRate;
-    for (int32 i = 0; i < NUM_OUTPUTS; ++i)
+    for (int32 i = 0; i < GetNumOutputs(); ++i)
     {
         auto [OutputSplitter,MaxRate,Ready2] = FindAutoSplitterAndMaxBeltRate(mOutputs[i], true);
         if (MaxRate > 0)
         {
-            mReplicated.OutputRates[i] = FRACTIONAL_RATE_MULTIPLIER;
-            mReplicated.OutputStates[i] = SetFlag(mReplicated.OutputStates[i], EOutputState::Connected);
+            mReplicated.Outputs[i].Rate = FRACTIONAL_RATE_MULTIPLIER;
+            mReplicated.Outputs[i].State = SetFlag(mReplicated.Outputs[i].State, EOutputState::Connected);
         }
         else
         {
-            mReplicated.OutputRates[i] = 0;
-            mReplicated.OutputStates[i] = ClearFlag(mReplicated.OutputStates[i], EOutputState::Connected);
+            mReplicated.Outputs[i].Rate = 0;
+            mReplicated.Outputs[i].State = ClearFlag(mReplicated.Outputs[i].State, EOutputState::Connected);
         }
-        mReplicated.OutputStates[i] = SetFlag(mReplicated.OutputStates[i], EOutputState::AutoSplitter, OutputSplitter != nullptr);
+        mReplicated.Outputs[i].State = SetFlag(mReplicated.Outputs[i].State, EOutputState::AutoSplitter, OutputSplitter != nullptr);
     }
     mNeedsInitialDistributionSetup = false;
     mBalancingRequired = true;
@@ -980,6 +957,21 @@ void AMFGBuildableAutoSplitter::SetupInitialDistributionState()
 
 std::tuple<bool,int32> AMFGBuildableAutoSplitter::Server_BalanceNetwork(AMFGBuildableAutoSplitter* ForSplitter, bool RootOnly)
 {
+    FBalancingJob Job;
+    if (!BeginBalancing(Job,ForSplitter,RootOnly))
+        return {false,-1};
+
+    ContinueBalancing(Job,0.0);
+
+    if (!Job.Network)
+        return {false,-1};
+    return {Job.Phase == FBalancingJob::EPhase::Done,Job.Network->Num()};
+}
+
+bool AMFGBuildableAutoSplitter::BeginBalancing(FBalancingJob& Job, AMFGBuildableAutoSplitter* ForSplitter, bool RootOnly)
+{
+    AUTO_SPLITTERS_SCOPE(BalanceNetwork);
+
     if (!ForSplitter)
     {
         UE_LOG(
@@ -987,442 +979,533 @@ std::tuple<bool,int32> AMFGBuildableAutoSplitter::Server_BalanceNetwork(AMFGBuil
             Error,
             TEXT("BalanceNetwork() must be called with a valid ForSplitter argument, aborting!")
             );
-        return {false,-1};
+        return false;
     }
 
     if(ForSplitter->IsSplitterFlagSet(EPersistent::NeedsConnectionsFixup) || !ForSplitter->HasActorBegunPlay())
     {
-        return {false,-1};
+        return false;
     }
 
-    TSet<AMFGBuildableAutoSplitter*> SplitterSet;
-    // start by going upstream
+    const auto AutoSplittersSubsystem = AAutoSplittersSubsystem::Get(ForSplitter);
+    const auto& Config = AutoSplittersSubsystem->GetConfig();
+
+    // start by going upstream, which is a lookup as long as the cached topology is current
     auto Root = ForSplitter;
-    SplitterSet.Add(Root);
-    for (
-        auto [Current,Rate,Ready] = FindAutoSplitterAndMaxBeltRate(Root->mInputs[0],false) ;
-        Current ;
-        std::tie(Current,Rate,Ready) = FindAutoSplitterAndMaxBeltRate(Current->mInputs[0],false)
-        )
+    FNetwork* Network = nullptr;
+    if (ForSplitter->GetNetworkNode() != NO_NODE)
     {
-        if (Current->IsSplitterFlagSet(EPersistent::NeedsConnectionsFixup) || !Current->HasActorBegunPlay())
-            return {false,-1};
-        if (SplitterSet.Contains(Current))
+        Network = ForSplitter->mNetwork;
+        Root = Network->Splitters[0];
+    }
+    else
+    {
+        TSet<AMFGBuildableAutoSplitter*> SplitterSet;
+        SplitterSet.Add(Root);
+        for (
+            auto [Current,Rate,Ready] = FindAutoSplitterAndMaxBeltRate(Root->mInputs[0],false) ;
+            Current ;
+            std::tie(Current,Rate,Ready) = FindAutoSplitterAndMaxBeltRate(Current->mInputs[0],false)
+            )
         {
-            UE_LOG(LogAutoSplitters,Warning,TEXT("Cycle in auto splitter network detected, bailing out"));
-            return {false,-1};
+            if (Current->IsSplitterFlagSet(EPersistent::NeedsConnectionsFixup) || !Current->HasActorBegunPlay())
+                return false;
+            if (SplitterSet.Contains(Current))
+            {
+                UE_LOG(LogAutoSplitters,Warning,TEXT("Cycle in auto splitter network detected, bailing out"));
+                ++ForSplitter->mStatistics.BalanceRuns;
+                ++ForSplitter->mStatistics.InvalidBalanceRuns;
+                return false;
+            }
+            SplitterSet.Add(Current);
+            Root = Current;
         }
-        SplitterSet.Add(Current);
-        Root = Current;
     }
 
     if (RootOnly && ForSplitter != Root)
     {
         Root->mBalancingRequired = true;
-        return {false,-1};
+        return false;
     }
 
-    const auto& Config = AAutoSplittersSubsystem::Get(ForSplitter)->GetConfig();
+    ++Root->mStatistics.BalanceRuns;
 
-    // Now walk the tree to discover the whole network
-    TArray<TArray<FNetworkNode>> Network;
-    int32 SplitterCount = 0;
-    if (!DiscoverHierarchy(Network,Root,0,nullptr, INT32_MAX,Root,Config.Features.RespectOverclocking))
+    Job.Root = Root;
+    Job.Subsystem = AutoSplittersSubsystem;
+    Job.Generation = AutoSplittersSubsystem->GetTopologyGeneration();
+    Job.ExtractPotentialShares = Config.Features.RespectOverclocking;
+    Job.RefreshPotentialShares = Network != nullptr;
+
+    if (Network)
     {
-        Root->mBalancingRequired = true;
-        return {false,-1};
+        BeginSolve(Job,*Network);
+    }
+    else
+    {
+        // Now walk the tree to discover the whole network
+        Job.Discovered = AutoSplittersSubsystem->AcquireNetwork();
+        Job.Pending.Reset();
+        Job.Pending.Add({Root,NO_NODE,0});
+        Job.Phase = FBalancingJob::EPhase::Discover;
     }
 
-    UE_LOG(LogAutoSplitters,Display,TEXT("Starting BalanceNetwork() algorithm for root splitter %p (%s)"),Root,*Root->GetName());
+    return true;
+}
+
+void AMFGBuildableAutoSplitter::BeginSolve(FBalancingJob& Job, FNetwork& Network)
+{
+    // only a successful run leaves consistent node results behind
+    Network.Balanced = false;
+    Job.Network = &Network;
+    Job.Revision = ++Network.Revision;
+    Job.Cursor = 0;
+    Job.Phase = FBalancingJob::EPhase::Snapshot;
+
+    const auto Root = Network.Splitters[0];
+    UE_LOG(LogAutoSplitters,Verbose,TEXT("Starting BalanceNetwork() algorithm for root splitter %p (%s)"),Root,*Root->GetName());
+    Root->mTrace.Record(EAutoSplitterTraceEvent::BalanceStart);
+}
+
+bool AMFGBuildableAutoSplitter::ContinueBalancing(FBalancingJob& Job, const double Deadline, const FBalancingJob::EPhase StopAt)
+{
+    using EPhase = FBalancingJob::EPhase;
+
+    // reading the clock is not free, so only check the deadline every few nodes
+    constexpr int32 NODES_PER_DEADLINE_CHECK = 16;
+
+    AUTO_SPLITTERS_SCOPE(BalanceNetwork);
 
-    for (int32 Level = Network.Num() - 1 ; Level >= 0 ; --Level)
+    if (Job.IsFinished())
+        return true;
+
+    // while the job was suspended, splitters might have been removed or rewired, or another run might have
+    // touched the network. A solve that is still running on a worker thread only works on its own copy of the
+    // network and can simply be dropped.
+    if (
+        !Job.Root.IsValid() ||
+        Job.Generation != Job.Subsystem->GetTopologyGeneration() ||
+        (Job.Network && Job.Network->Revision != Job.Revision)
+        )
     {
-        for (auto& Node: Network[Level])
-        {
-            ++SplitterCount;
+        if (Job.Discovered)
+            Job.Subsystem->ReleaseNetwork(MoveTemp(Job.Discovered));
+        Job.Solve.Reset();
+        Job.Phase = EPhase::Stale;
+        return true;
+    }
 
-            auto& Splitter = *Node.Splitter;
-            Splitter.mBalancingRequired = false;
+    const auto Root = Job.Root.Get();
+    for (int32 Steps = 1 ; !Job.IsFinished() && Job.Phase < StopAt ; ++Steps)
+    {
+        switch (Job.Phase)
+        {
+        case EPhase::Discover:
+            if (Job.Pending.Num() == 0)
+            {
+                BeginSolve(Job,Job.Subsystem->StoreNetwork(Root,MoveTemp(Job.Discovered)));
+            }
+            else if (!DiscoverNextSplitter(Job))
+            {
+                Job.Subsystem->ReleaseNetwork(MoveTemp(Job.Discovered));
+                ++Root->mStatistics.InvalidBalanceRuns;
+                Root->mBalancingRequired = true;
+                Job.Phase = EPhase::Failed;
+            }
+            break;
 
-            for (int32 i = 0 ; i < NUM_OUTPUTS ; ++i)
+        case EPhase::Snapshot:
+            if (Job.Cursor < Job.Network->Num())
             {
-                if (Node.MaxOutputRates[i] == 0)
+                if (Job.RefreshPotentialShares)
                 {
-                    if (IsSet(Splitter.mReplicated.OutputStates[i],EOutputState::Connected))
+                    for (int32 i = 0 ; i < MAX_OUTPUTS ; ++i)
                     {
-                        Splitter.mReplicated.OutputStates[i] = ClearFlag(Splitter.mReplicated.OutputStates[i],EOutputState::Connected);
-                        Node.ConnectionStateChanged = true;
+                        if (const auto Factory = Job.Network->Factories[Job.Cursor][i])
+                            Job.Network->Graph.PotentialShares[Job.Cursor][i] = GetPotentialShares(Factory,Job.ExtractPotentialShares);
                     }
-                    if (IsSet(Splitter.mReplicated.OutputStates[i], EOutputState::AutoSplitter))
-                    {
-                        Splitter.mReplicated.OutputStates[i] = ClearFlag(Splitter.mReplicated.OutputStates[i],EOutputState::AutoSplitter);
-                        Node.ConnectionStateChanged = true;
-                    }
-                    continue;
                 }
+                SnapshotNode(*Job.Network,Job.Cursor++);
+            }
+            else if (!Job.SolveAsync)
+            {
+                Job.Result = Job.Network->Graph.Solve(Job.FailedNode);
+                Job.Phase = EPhase::Apply;
+            }
+            else
+            {
+                // The task only sees plain data, the splitters are left alone until the solve gets applied. Copying
+                // into the solve graph of the network reuses its storage, unless a dropped task still holds on to it.
+                auto& PooledSolve = Job.Network->Solve;
+                if (!PooledSolve.IsValid() || !PooledSolve.IsUnique())
+                    PooledSolve = MakeShared<FBalancingSolve,ESPMode::ThreadSafe>();
+                PooledSolve->Graph = Job.Network->Graph;
+                Job.Solve = PooledSolve;
+                Job.SolveDone = Async(
+                    EAsyncExecution::TaskGraph,
+                    [Solve = Job.Solve]()
+                    {
+                        AUTO_SPLITTERS_SCOPE(SolveNetwork);
+                        Solve->Result = Solve->Graph.Solve(Solve->FailedNode);
+                    });
+                Job.Phase = EPhase::Solve;
+            }
+            break;
 
-                if (!IsSet(Splitter.mReplicated.OutputStates[i], EOutputState::Connected))
-                {
-                    Splitter.mReplicated.OutputStates[i] = SetFlag(Splitter.mReplicated.OutputStates[i], EOutputState::Connected);
-                    Node.ConnectionStateChanged = true;
-                }
+        case EPhase::Solve:
+            // pick up the results on a later tick
+            if (!Job.SolveDone.IsReady())
+                return false;
+            std::swap(Job.Network->Graph,Job.Solve->Graph);
+            Job.Result = Job.Solve->Result;
+            Job.FailedNode = Job.Solve->FailedNode;
+            Job.Solve.Reset();
+            Job.Phase = EPhase::Apply;
+            break;
 
-                if (Node.Outputs[i])
-                {
-                    if (!IsSet(Splitter.mReplicated.OutputStates[i], EOutputState::AutoSplitter))
-                    {
-                        Splitter.mReplicated.OutputStates[i] = SetFlag(Splitter.mReplicated.OutputStates[i],EOutputState::AutoSplitter);
-                        Node.ConnectionStateChanged = true;
-                    }
-                    auto& OutputNode = *Node.Outputs[i];
-                    auto& OutputSplitter = *OutputNode.Splitter;
-                    if (OutputSplitter.IsSplitterFlagSet(EPersistent::ManualInputRate))
-                    {
-                        Splitter.mReplicated.OutputStates[i] = ClearFlag(Splitter.mReplicated.OutputStates[i],EOutputState::Automatic);
-                        Node.FixedDemand += OutputSplitter.mReplicated.TargetInputRate;
-                    }
-                    else
-                    {
-                        Splitter.mReplicated.OutputStates[i] = SetFlag(Splitter.mReplicated.OutputStates[i],EOutputState::Automatic);
-                        Node.Shares += OutputNode.Shares;
-                        Node.FixedDemand += OutputNode.FixedDemand;
-                    }
-                }
-                else
-                {
-                    if (IsSet(Splitter.mReplicated.OutputStates[i], EOutputState::AutoSplitter))
-                    {
-                        Splitter.mReplicated.OutputStates[i] = ClearFlag(Splitter.mReplicated.OutputStates[i],EOutputState::AutoSplitter);
-                        Node.ConnectionStateChanged = true;
-                    }
-                    if (IsSet(Splitter.mReplicated.OutputStates[i],EOutputState::Automatic))
-                    {
-                        Node.Shares += Node.PotentialShares[i];
-                    }
-                    else
-                    {
-                        Node.FixedDemand += Splitter.mReplicated.OutputRates[i];
-                    }
-                }
+        case EPhase::Apply:
+            if (Job.Result != FNetworkGraph::EAllocationResult::Ready)
+            {
+                ReportAllocationFailure(*Job.Network,Job.FailedNode,Job.Result);
+                ++Root->mStatistics.InvalidBalanceRuns;
+                Job.Phase = EPhase::Failed;
+                break;
+            }
+
+            // we have a consistent new network setup, now switch the whole network to the new settings at once
+            for (int32 Node = 0 ; Node < Job.Network->Num() ; ++Node)
+            {
+                ApplyNode(*Job.Network,Node);
             }
+
+            // local changes can now be rebalanced incrementally
+            Job.Network->Balanced = true;
+            Job.Phase = EPhase::Done;
+            break;
+
+        default:
+            break;
         }
+
+        if (Deadline > 0.0 && Steps % NODES_PER_DEADLINE_CHECK == 0 && FPlatformTime::Seconds() > Deadline)
+            break;
     }
 
-    // Ok, now for the hard part: distribute the available items
+    return Job.IsFinished();
+}
+
+std::tuple<bool,int32> AMFGBuildableAutoSplitter::Server_RebalanceNetwork(AMFGBuildableAutoSplitter* ForSplitter)
+{
+    const auto NetworkNode = ForSplitter->GetNetworkNode();
+    if (NetworkNode == NO_NODE || !ForSplitter->mNetwork->Balanced)
+        return Server_BalanceNetwork(ForSplitter);
+
+    AUTO_SPLITTERS_SCOPE(BalanceNetwork);
 
-    Network[0][0].AllocatedInputRate = Root->mReplicated.TargetInputRate;
-    bool Valid = true;
-    for (auto& Level : Network)
+    auto& Network = *ForSplitter->mNetwork;
+    auto& Graph = Network.Graph;
+
+    // pending structural changes require a full run
+    TArray<int32,TInlineAllocator<16>> Path;
+    TBitArray<> OnPath(false,Network.Num());
+    for (auto Node = NetworkNode ; Node != NO_NODE ; Node = Graph.Input[Node])
     {
-        if (!Valid)
-            break;
-        for (auto& Node : Level)
+        if (Network.Splitters[Node]->mBalancingRequired)
+            return Server_BalanceNetwork(ForSplitter);
+        for (const auto Output : Graph.Outputs[Node])
         {
-            auto& Splitter = *Node.Splitter;
-            if (Node.MaxInputRate < Node.FixedDemand)
-            {
-                UE_LOG(
-                    LogAutoSplitters,
-                    Warning,
-                    TEXT("Max input rate is not sufficient to satisfy fixed demand: %d < %d"),
-                    Node.MaxInputRate,
-                    Node.FixedDemand
-                    );
-                Valid = false;
-                break;
-            }
+            if (Output != NO_NODE && Network.Splitters[Output]->mBalancingRequired)
+                return Server_BalanceNetwork(ForSplitter);
+        }
+        Path.Add(Node);
+        OnPath[Node] = true;
+    }
 
-            int32 AvailableForShares = Node.AllocatedInputRate - Node.FixedDemand;
+    auto Root = Network.Splitters[0];
+    ++Root->mStatistics.BalanceRuns;
+    Root->mTrace.Record(EAutoSplitterTraceEvent::BalanceStart);
 
-            if (AvailableForShares < 0)
-            {
-                UE_LOG(
-                    LogAutoSplitters,
-                    Warning,
-                    TEXT("Not enough available input for requested fixed output rates: demand=%d available=%d"),
-                    Node.FixedDemand,
-                    Node.AllocatedInputRate
-                    );
-                Valid = false;
-                break;
-            }
+    // a suspended full run would otherwise overwrite this change with outdated aggregates
+    ++Network.Revision;
 
-            // Avoid division by zero
-            auto [RatePerShare,Remainder] = Node.Shares > 0 ? std::div(static_cast<int64>(AvailableForShares) * FRACTIONAL_SHARE_MULTIPLIER, Node.Shares) : std::lldiv_t{0,0};
+    // the setters change the manual flag and target rate of the splitter at the changed output in place
+    for (const auto Node : Path)
+    {
+        for (const auto Output : Graph.Outputs[Node])
+        {
+            if (Output != NO_NODE && !OnPath[Output])
+                SnapshotNode(Network,Output);
+        }
+    }
 
-            if (Remainder != 0)
-            {
-                UE_LOG(
-                    LogAutoSplitters,
-                    Warning,
-                    TEXT("Could not evenly distribute rate among shares: available=%d shares=%lld rate=%lld remainder=%lld"),
-                    AvailableForShares,
-                    Node.Shares,
-                    RatePerShare,
-                    Remainder
-                );
-                // Valid = false;
-                // break;
-            }
+    // the aggregates of all nodes that are not upstream of the change are still valid
+    for (const auto Node : Path)
+    {
+        SnapshotNode(Network,Node);
+        Graph.AggregateNode(Node);
+    }
 
-            if (DEBUG_SPLITTER(Splitter))
+    // walk back down, but only into subtrees that are upstream of the change or whose input rate changed
+    TArray<int32,TInlineAllocator<64>> Pending;
+    TArray<int32,TInlineAllocator<64>> Allocated;
+    Graph.AllocatedInputRate[0] = Root->mReplicated.TargetInputRate;
+    Pending.Add(0);
+    while (Pending.Num() > 0)
+    {
+        const auto Node = Pending.Pop(false);
+        const auto& Outputs = Graph.Outputs[Node];
+
+        std::array<int32,MAX_OUTPUTS> PreviousInputRates;
+        for (int32 i = 0 ; i < MAX_OUTPUTS ; ++i)
+        {
+            PreviousInputRates[i] = Outputs[i] != NO_NODE ? Graph.AllocatedInputRate[Outputs[i]] : 0;
+        }
+
+        const auto Result = Graph.AllocateNode(Node);
+        if (Result != FNetworkGraph::EAllocationResult::Ready)
+        {
+            ReportAllocationFailure(Network,Node,Result);
+            ++Root->mStatistics.InvalidBalanceRuns;
+            // the caller will roll back the change, which leaves the cached aggregates stale
+            Network.Balanced = false;
+            return {false,Allocated.Num() + 1};
+        }
+        Allocated.Add(Node);
+
+        for (int32 i = 0 ; i < MAX_OUTPUTS ; ++i)
+        {
+            const auto Output = Outputs[i];
+            if (Output != NO_NODE && (OnPath[Output] || Graph.AllocatedInputRate[Output] != PreviousInputRates[i]))
             {
-                UE_LOG(
-                    LogAutoSplitters,
-                    Display,
-                    TEXT("distribution setup: input=%d fixedDemand=%d ratePerShare=%lld shares=%lld remainder=%lld"),
-                    Node.AllocatedInputRate,
-                    Node.FixedDemand,
-                    RatePerShare,
-                    Node.Shares,
-                    Remainder
-                    );
+                Pending.Add(Output);
             }
+        }
+    }
+
+    for (const auto Node : Allocated)
+    {
+        ApplyNode(Network,Node);
+    }
 
-            int64 UndistributedShares = 0;
-            int64 UndistributedRate = 0;
+    return {true,Allocated.Num()};
+}
+
+void AMFGBuildableAutoSplitter::SnapshotNode(FNetwork& Network, const int32 Node)
+{
+    auto& Graph = Network.Graph;
+    auto& Splitter = *Network.Splitters[Node];
+    Splitter.mBalancingRequired = false;
+
+    Graph.ManualInputRate[Node] = Splitter.IsSplitterFlagSet(EPersistent::ManualInputRate);
+    Graph.TargetInputRate[Node] = Splitter.mReplicated.TargetInputRate;
+    Graph.AutomaticOutputs[Node] = 0;
+
+    // work on a copy, the splitter keeps its current states until the node is applied
+    auto& States = Graph.OutputStates[Node];
+    States = Splitter.GatherOutputs(&FMFGBuildableAutoSplitterOutput::State);
+    Graph.OutputRates[Node] = Splitter.GatherOutputs(&FMFGBuildableAutoSplitterOutput::Rate);
 
-            for (int32 i = 0; i < NUM_OUTPUTS; ++i)
+    for (int32 i = 0 ; i < MAX_OUTPUTS ; ++i)
+    {
+        const auto Output = Graph.Outputs[Node][i];
+        if (Graph.MaxOutputRates[Node][i] == 0)
+        {
+            if (IsSet(States[i],EOutputState::Connected))
             {
-                if (Node.Outputs[i])
-                {
-                    if (Node.Outputs[i]->Splitter->IsSplitterFlagSet(EPersistent::ManualInputRate))
-                    {
-                        Node.AllocatedOutputRates[i] = Node.Outputs[i]->Splitter->mReplicated.TargetInputRate;
-                    }
-                    else
-                    {
-                        int64 Rate = RatePerShare * Node.Outputs[i]->Shares;
-                        if (Remainder > 0)
-                        {
-                            auto [ExtraRate,NewUndistributedShares] = std::div(UndistributedShares + RatePerShare * Node.Outputs[i]->Shares,Remainder);
-                            UE_LOG(
-                                LogAutoSplitters,
-                                Display,
-                                TEXT("Output %d: increasing rate from %lld to %lld, newUndistributedShares=%lld"),
-                                i,
-                                Rate,
-                                Rate + ExtraRate,
-                                NewUndistributedShares
-                                );
-                            UndistributedShares = NewUndistributedShares;
-                            Rate += ExtraRate;
-                        }
-
-                        auto [ShareBasedRate,OutputRemainder] = std::div(Rate,FRACTIONAL_SHARE_MULTIPLIER);
-                        if (OutputRemainder != 0)
-                        {
-                            UE_LOG(
-                                LogAutoSplitters,
-                                Warning,
-                                TEXT("Could not calculate fixed precision output rate for output %d (autosplitter): RatePerShare=%lld Shares=%lld rate=%lld remainder=%lld"),
-                                i,
-                                RatePerShare,
-                                Node.Outputs[i]->Shares,
-                                ShareBasedRate,
-                                OutputRemainder
-                            );
-                            UndistributedRate += OutputRemainder;
-                        }
-                        Node.AllocatedOutputRates[i] = Node.Outputs[i]->FixedDemand + ShareBasedRate;
-                    }
-                    Node.Outputs[i]->AllocatedInputRate = Node.AllocatedOutputRates[i];
-                }
-                else
-                {
-                    if (IsSet(Splitter.mReplicated.OutputStates[i], EOutputState::Connected))
-                    {
-                        if (IsSet(Splitter.mReplicated.OutputStates[i], EOutputState::Automatic))
-                        {
-                            int64 Rate = RatePerShare * Node.PotentialShares[i];
-                            if (Remainder > 0)
-                            {
-                                auto [ExtraRate,NewUndistributedShares] = std::div(UndistributedShares + RatePerShare * Node.PotentialShares[i],Remainder);
-                                UE_LOG(
-                                    LogAutoSplitters,
-                                    Display,
-                                    TEXT("Output %d: increasing rate from %lld to %lld, newUndistributedShares=%lld"),
-                                    i,
-                                    Rate,
-                                    Rate + ExtraRate,
-                                    NewUndistributedShares
-                                    );
-                                UndistributedShares = NewUndistributedShares;
-                                Rate += ExtraRate;
-                            }
-
-                            auto [ShareBasedRate,OutputRemainder] = std::div(Rate,FRACTIONAL_SHARE_MULTIPLIER);
-                            if (OutputRemainder != 0)
-                            {
-                                UE_LOG(
-                                    LogAutoSplitters,
-                                    Warning,
-                                    TEXT("Could not calculate fixed precision output rate for output %d: RatePerShare=%lld PotentialShares=%lld rate=%lld remainder=%lld"),
-                                    i,
-                                    RatePerShare,
-                                    Node.PotentialShares[i],
-                                    ShareBasedRate,
-                                    OutputRemainder
-                                );
-                                UndistributedRate += OutputRemainder;
-                            }
-                            Node.AllocatedOutputRates[i] = ShareBasedRate;
-                        }
-                        else
-                        {
-                            Node.AllocatedOutputRates[i] = Splitter.mReplicated.OutputRates[i];
-                        }
-                    }
-                }
+                States[i] = ClearFlag(States[i],EOutputState::Connected);
+                Graph.ConnectionStateChanged[Node] = true;
             }
-
-            if (UndistributedRate > 0)
+            if (IsSet(States[i], EOutputState::AutoSplitter))
             {
-                UE_LOG(LogAutoSplitters, Warning, TEXT("%lld units of unallocated distribution rate"),UndistributedRate);
+                States[i] = ClearFlag(States[i],EOutputState::AutoSplitter);
+                Graph.ConnectionStateChanged[Node] = true;
             }
+            continue;
+        }
 
-            if (true)
+        if (!IsSet(States[i], EOutputState::Connected))
+        {
+            States[i] = SetFlag(States[i], EOutputState::Connected);
+            Graph.ConnectionStateChanged[Node] = true;
+        }
+
+        if (Output != NO_NODE)
+        {
+            if (!IsSet(States[i], EOutputState::AutoSplitter))
             {
-                UE_LOG(
-                    LogAutoSplitters,
-                    Display,
-                    TEXT("allocated output rates: %d %d %d"),
-                    Node.AllocatedOutputRates[0],
-                    Node.AllocatedOutputRates[1],
-                    Node.AllocatedOutputRates[2]
-                    );
+                States[i] = SetFlag(States[i],EOutputState::AutoSplitter);
+                Graph.ConnectionStateChanged[Node] = true;
             }
+            States[i] = SetFlag(
+                States[i],
+                EOutputState::Automatic,
+                !Network.Splitters[Output]->IsSplitterFlagSet(EPersistent::ManualInputRate)
+                );
+        }
+        else if (IsSet(States[i], EOutputState::AutoSplitter))
+        {
+            States[i] = ClearFlag(States[i],EOutputState::AutoSplitter);
+            Graph.ConnectionStateChanged[Node] = true;
+        }
+
+        if (IsSet(States[i],EOutputState::Automatic))
+        {
+            Graph.AutomaticOutputs[Node] |= 1u << i;
         }
     }
+}
 
-    if (!Valid)
+void AMFGBuildableAutoSplitter::ReportAllocationFailure(
+    FNetwork& Network,
+    const int32 Node,
+    const FNetworkGraph::EAllocationResult Result
+)
+{
+    const auto& Graph = Network.Graph;
+    auto& Splitter = *Network.Splitters[Node];
+    if (Result == FNetworkGraph::EAllocationResult::ExceedsMaxInputRate)
     {
         UE_LOG(
             LogAutoSplitters,
             Warning,
-            TEXT("Invalid network configuration, aborting network balancing")
+            TEXT("Max input rate is not sufficient to satisfy fixed demand: %d < %d"),
+            Graph.MaxInputRate[Node],
+            Graph.FixedDemand[Node]
             );
-        return {false,SplitterCount};
+        Splitter.mTrace.Record(EAutoSplitterTraceEvent::BalanceInvalid,Graph.FixedDemand[Node],Graph.MaxInputRate[Node]);
     }
+    else
+    {
+        UE_LOG(
+            LogAutoSplitters,
+            Warning,
+            TEXT("Not enough available input for requested fixed output rates: demand=%d available=%d"),
+            Graph.FixedDemand[Node],
+            Graph.AllocatedInputRate[Node]
+            );
+        Splitter.mTrace.Record(EAutoSplitterTraceEvent::BalanceInvalid,Graph.FixedDemand[Node],Graph.AllocatedInputRate[Node]);
+    }
+    UE_LOG(
+        LogAutoSplitters,
+        Warning,
+        TEXT("Invalid network configuration, aborting network balancing")
+        );
+}
 
-    // we have a consistent new network setup, now switch the network to the new settings
-    for (auto& Level: Network)
+void AMFGBuildableAutoSplitter::ApplyNode(FNetwork& Network, const int32 Node)
+{
+    auto& Graph = Network.Graph;
+    auto& Splitter = *Network.Splitters[Node];
+    bool NeedsSetupDistribution = Graph.ConnectionStateChanged[Node];
+
+    for (int32 i = 0 ; i < MAX_OUTPUTS ; ++i)
     {
-        for (auto& Node : Level)
+        if (Graph.RateRounding[Node][i] != 0)
         {
-            auto& Splitter = *Node.Splitter;
-            bool NeedsSetupDistribution = Node.ConnectionStateChanged;
+            Splitter.mTrace.Record(EAutoSplitterTraceEvent::BalanceRemainder,i,Graph.RateRounding[Node][i]);
+        }
+    }
 
-            if (Splitter.mReplicated.TargetInputRate != Node.AllocatedInputRate)
-            {
-                NeedsSetupDistribution = true;
-                Splitter.mReplicated.TargetInputRate = Node.AllocatedInputRate;
-            }
+    Splitter.mTrace.RecordOutputs(EAutoSplitterTraceEvent::BalanceRates,Graph.AllocatedOutputRates[Node],Splitter.GetNumOutputs());
 
-            for (int32 i = 0 ; i < NUM_OUTPUTS ; ++i)
-            {
-                if (IsSet(Splitter.mReplicated.OutputStates[i],EOutputState::Connected) && Splitter.mReplicated.OutputRates[i] != Node.AllocatedOutputRates[i])
-                {
-                    NeedsSetupDistribution = true;
-                    Splitter.mReplicated.OutputRates[i] = Node.AllocatedOutputRates[i];
-                }
-            }
+    if (DEBUG_SPLITTER(Splitter))
+    {
+        UE_LOG(
+            LogAutoSplitters,
+            Display,
+            TEXT("allocated output rates: input=%d fixedDemand=%d shares=%lld outputs=%s"),
+            Graph.AllocatedInputRate[Node],
+            Graph.FixedDemand[Node],
+            Graph.Shares[Node],
+            *Splitter.FormatOutputs(Graph.AllocatedOutputRates[Node])
+            );
+    }
 
-            if (NeedsSetupDistribution)
-            {
-                Splitter.SetSplitterFlag(EPersistent::NeedsDistributionSetup);
-            }
+    if (Splitter.mReplicated.TargetInputRate != Graph.AllocatedInputRate[Node])
+    {
+        NeedsSetupDistribution = true;
+        Splitter.mReplicated.TargetInputRate = Graph.AllocatedInputRate[Node];
+    }
+
+    for (int32 i = 0 ; i < Splitter.mReplicated.Outputs.Num() ; ++i)
+    {
+        Splitter.mReplicated.Outputs[i].State = Graph.OutputStates[Node][i];
+        if (IsSet(Splitter.mReplicated.Outputs[i].State,EOutputState::Connected) && Splitter.mReplicated.Outputs[i].Rate != Graph.AllocatedOutputRates[Node][i])
+        {
+            NeedsSetupDistribution = true;
+            Splitter.mReplicated.Outputs[i].Rate = Graph.AllocatedOutputRates[Node][i];
         }
     }
 
-    return {true,SplitterCount};
+    if (NeedsSetupDistribution)
+    {
+        Splitter.SetSplitterFlag(EPersistent::NeedsDistributionSetup);
+    }
+
+    Graph.ConnectionStateChanged[Node] = false;
+}
+
+int32 AMFGBuildableAutoSplitter::GetNetworkNode() const
+{
+    if (!mNetwork || mNetworkGeneration != AAutoSplittersSubsystem::Get(GetWorld())->GetTopologyGeneration())
+        return NO_NODE;
+    return mNetworkNode;
+}
+
+int64 AMFGBuildableAutoSplitter::GetPotentialShares(AFGBuildableFactory* Factory, bool ExtractPotentialShares)
+{
+    if (ExtractPotentialShares)
+        return static_cast<int64>(Factory->GetPendingPotential() * FRACTIONAL_SHARE_MULTIPLIER);
+    return FRACTIONAL_SHARE_MULTIPLIER;
 }
 
 std::tuple<AMFGBuildableAutoSplitter*, int32, bool> AMFGBuildableAutoSplitter::FindAutoSplitterAndMaxBeltRate(
     UFGFactoryConnectionComponent* Connection, bool Forward)
 {
-    int32 Rate = INT32_MAX;
-    while (Connection->IsConnected())
-    {
-        Connection = Connection->GetConnection();
-        const auto Belt = Cast<AFGBuildableConveyorBase>(Connection->GetOuterBuildable());
-        if (Belt)
-        {
-            Connection = Forward ? Belt->GetConnection1() : Belt->GetConnection0();
-            Rate = std::min(Rate,static_cast<int32>(Belt->GetSpeed()) * (FRACTIONAL_RATE_MULTIPLIER / 2));
-            continue;
-        }
-        return {Cast<AMFGBuildableAutoSplitter>(Connection->GetOuterBuildable()),Rate,true};
-    }
-    return {nullptr,0,true};
+    const auto Chain = AAutoSplittersSubsystem::Get(Connection)->FindConveyorChain(Connection,Forward);
+    return {Cast<AMFGBuildableAutoSplitter>(Chain.Endpoint),Chain.MaxRate,true};
 }
 
 std::tuple<AFGBuildableFactory*, int32, bool> AMFGBuildableAutoSplitter::FindFactoryAndMaxBeltRate(
     UFGFactoryConnectionComponent* Connection, bool Forward)
 {
-    int32 Rate = INT32_MAX;
-    while (Connection->IsConnected())
-    {
-        Connection = Connection->GetConnection();
-        const auto Belt = Cast<AFGBuildableConveyorBase>(Connection->GetOuterBuildable());
-        if (Belt)
-        {
-            Connection = Forward ? Belt->GetConnection1() : Belt->GetConnection0();
-            Rate = std::min(Rate,static_cast<int32>(Belt->GetSpeed()) * (FRACTIONAL_RATE_MULTIPLIER / 2));
-            continue;
-        }
-        return {Cast<AFGBuildableFactory>(Connection->GetOuterBuildable()),Rate,true};
-    }
-    return {nullptr,0,true};
+    const auto Chain = AAutoSplittersSubsystem::Get(Connection)->FindConveyorChain(Connection,Forward);
+    return {Cast<AFGBuildableFactory>(Chain.Endpoint),Chain.MaxRate,true};
 }
 
-bool AMFGBuildableAutoSplitter::DiscoverHierarchy(
-    TArray<TArray<FNetworkNode>>& Nodes,
-    AMFGBuildableAutoSplitter* Splitter,
-    const int32 Level,
-    FNetworkNode* InputNode,
-    const int32 ChildInParent,
-    AMFGBuildableAutoSplitter* Root,
-    bool ExtractPotentialShares
-)
+bool AMFGBuildableAutoSplitter::DiscoverNextSplitter(FBalancingJob& Job)
 {
+    AUTO_SPLITTERS_SCOPE(DiscoverHierarchy);
+
+    // Work through the tree with an explicit stack, long chains of splitters would otherwise need one stack frame
+    // per splitter. Nodes are only added when they are popped, so every node still ends up after its input.
+    auto& Network = *Job.Discovered;
+    const auto [Splitter,InputNode,ChildInParent] = Job.Pending.Pop(false);
     if (!Splitter->HasActorBegunPlay())
         return false;
-    if (!Nodes.IsValidIndex(Level))
-    {
-        Nodes.Emplace();
-    }
-    auto& Node = Nodes[Level][Nodes[Level].Emplace(Splitter,InputNode)];
-    if (InputNode)
-    {
-        InputNode->Outputs[ChildInParent] = &Node;
-        Node.MaxInputRate = InputNode->MaxOutputRates[ChildInParent];
-    }
-    else
+
+    const auto Node = Network.AddNode(Splitter,InputNode,ChildInParent);
+    if (InputNode == NO_NODE)
     {
         auto [_,MaxRate,Ready] = FindAutoSplitterAndMaxBeltRate(Splitter->mInputs[0],false);
-        Node.MaxInputRate = MaxRate;
+        Network.Graph.MaxInputRate[Node] = MaxRate;
     }
-    for (int32 i = 0 ; i < NUM_OUTPUTS ; ++i)
+
+    // push in reverse, so the outputs get discovered in order
+    for (int32 i = Splitter->GetNumOutputs() - 1 ; i >= 0 ; --i)
     {
         const auto [Downstream,MaxRate,Ready] = FindFactoryAndMaxBeltRate(Splitter->mOutputs[i], true);
-        Node.MaxOutputRates[i] = MaxRate;
+        Network.Graph.MaxOutputRates[Node][i] = MaxRate;
         if (Downstream)
         {
             const auto DownstreamAutoSplitter = Cast<AMFGBuildableAutoSplitter>(Downstream);
             if (DownstreamAutoSplitter)
             {
-                if (!DiscoverHierarchy(Nodes, DownstreamAutoSplitter, Level + 1, &Node, i, Root, ExtractPotentialShares))
-                {
-                    return false;
-                }
+                Job.Pending.Add({DownstreamAutoSplitter,Node,i});
             }
             else
             {
-                if (ExtractPotentialShares)
-                    Node.PotentialShares[i] = static_cast<int32>(Downstream->GetPendingPotential() * FRACTIONAL_SHARE_MULTIPLIER);
-                else
-                    Node.PotentialShares[i] = FRACTIONAL_SHARE_MULTIPLIER;
+                Network.Factories[Node][i] = Downstream;
+                Network.Graph.PotentialShares[Node][i] = GetPotentialShares(Downstream,Job.ExtractPotentialShares);
             }
         }
     }
@@ -1441,3 +1524,126 @@ void AMFGBuildableAutoSplitter::SetSplitterVersion(uint32 Version)
     }
     mReplicated.PersistentState = (mReplicated.PersistentState & ~0xFFu) | (Version & 0xFFu);
 }
+
+void AMFGBuildableAutoSplitter::FormatTrace(FString& Out) const
+{
+    Out += FString::Printf(
+        TEXT("%s: targetInput=%d outputRates=(%s) outputStates=(%s) cycleLength=%d leftInCycle=%d remaining=(%s) itemsPerCycle=(%s) items=%d\n"),
+        *GetName(),
+        mReplicated.TargetInputRate,
+        *FormatOutputs(GatherOutputs(&FMFGBuildableAutoSplitterOutput::Rate)),
+        *FormatOutputs(GatherOutputs(&FMFGBuildableAutoSplitterOutput::State)),
+        mDistribution.CycleLength,
+        mDistribution.LeftInCycle,
+        *FormatOutputs(mDistribution.LeftInCycleForOutputs),
+        *FormatOutputs(mDistribution.ItemsPerCycle),
+        mItemBuffer.Num()
+        );
+    mTrace.Format(Out);
+    Out += TEXT("\n");
+}
+
+AMFGBuildableAutoSplitter* AMFGBuildableAutoSplitter::FindNetworkRoot(AMFGBuildableAutoSplitter* Splitter)
+{
+    if (Splitter->GetNetworkNode() != NO_NODE)
+        return Splitter->mNetwork->Splitters[0];
+
+    // go upstream, but don't get stuck in cycles
+    TSet<AMFGBuildableAutoSplitter*> Upstream;
+    auto Root = Splitter;
+    Upstream.Add(Root);
+    for (
+        auto [Current,Rate,Ready] = FindAutoSplitterAndMaxBeltRate(Root->mInputs[0],false) ;
+        Current && !Upstream.Contains(Current) ;
+        std::tie(Current,Rate,Ready) = FindAutoSplitterAndMaxBeltRate(Current->mInputs[0],false)
+        )
+    {
+        Upstream.Add(Current);
+        Root = Current;
+    }
+    return Root;
+}
+
+void AMFGBuildableAutoSplitter::CollectNetwork(AMFGBuildableAutoSplitter* Splitter, TSet<AMFGBuildableAutoSplitter*>& out_Splitters)
+{
+    if (Splitter->GetNetworkNode() != NO_NODE)
+    {
+        out_Splitters.Append(Splitter->mNetwork->Splitters);
+        return;
+    }
+
+    TArray<AMFGBuildableAutoSplitter*> Pending;
+    Pending.Add(FindNetworkRoot(Splitter));
+    while (Pending.Num() > 0)
+    {
+        auto Current = Pending.Pop(false);
+        if (out_Splitters.Contains(Current))
+            continue;
+        out_Splitters.Add(Current);
+        for (int32 i = 0 ; i < Current->GetNumOutputs() ; ++i)
+        {
+            auto [Downstream,Rate,Ready] = FindAutoSplitterAndMaxBeltRate(Current->mOutputs[i],true);
+            if (Downstream)
+                Pending.Add(Downstream);
+        }
+    }
+}
+
+void AMFGBuildableAutoSplitter::DumpTraces(const TArray<FString>& Args, UWorld* World)
+{
+    if (!World || World->GetNetMode() == NM_Client)
+    {
+        UE_LOG(LogAutoSplitters,Warning,TEXT("AutoSplitters.DumpTrace is only available on the server"));
+        return;
+    }
+
+    bool WholeNetwork = false;
+    FString SplitterName;
+    for (const auto& Arg : Args)
+    {
+        if (Arg == TEXT("network"))
+            WholeNetwork = true;
+        else
+            SplitterName = Arg;
+    }
+
+    TSet<AMFGBuildableAutoSplitter*> Splitters;
+    for (TActorIterator<AMFGBuildableAutoSplitter> It(World) ; It ; ++It)
+    {
+        const bool Selected = SplitterName.IsEmpty() ? DEBUG_SPLITTER(**It) : It->GetName() == SplitterName;
+        if (!Selected)
+            continue;
+        if (WholeNetwork)
+            CollectNetwork(*It,Splitters);
+        else
+            Splitters.Add(*It);
+    }
+
+    if (Splitters.Num() == 0)
+    {
+        UE_LOG(LogAutoSplitters,Warning,TEXT("AutoSplitters.DumpTrace: no matching Auto Splitters found"));
+        return;
+    }
+
+    FString Out = FString::Printf(TEXT("AutoSplitters trace at frame %llu\n\n"),static_cast<uint64>(GFrameCounter));
+    for (const auto Splitter : Splitters)
+    {
+        Splitter->FormatTrace(Out);
+    }
+
+    const auto FileName = FPaths::Combine(FPaths::ProjectLogDir(),TEXT("AutoSplitters-Trace.log"));
+    if (!FFileHelper::SaveStringToFile(Out,*FileName))
+    {
+        UE_LOG(LogAutoSplitters,Error,TEXT("Could not write Auto Splitter trace to %s"),*FileName);
+        return;
+    }
+
+    UE_LOG(LogAutoSplitters,Display,TEXT("Wrote trace of %d Auto Splitters to %s"),Splitters.Num(),*FileName);
+}
+
+static FAutoConsoleCommandWithWorldAndArgs GAutoSplittersDumpTraceCommand(
+    TEXT("AutoSplitters.DumpTrace"),
+    TEXT("Writes the event trace of the Auto Splitters in debug mode (or of the named splitter) to AutoSplitters-Trace.log. ")
+    TEXT("Add 'network' to include the whole network of each selected splitter."),
+    FConsoleCommandWithWorldAndArgsDelegate::CreateStatic(&AMFGBuildableAutoSplitter::DumpTraces)
+    );
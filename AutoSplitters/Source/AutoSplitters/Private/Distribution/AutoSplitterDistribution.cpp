@@ -0,0 +1,725 @@
+// ILikeBanas
+
+#include "Distribution/AutoSplitterDistribution.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <utility>
+
+// All x64 targets have SSE2, so this only falls back to the scalar selection on other architectures. Defining
+// AUTO_SPLITTERS_SSE2 to 0 forces the scalar selection, the standalone benchmark uses that for comparison.
+#ifndef AUTO_SPLITTERS_SSE2
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AUTO_SPLITTERS_SSE2 1
+#else
+#define AUTO_SPLITTERS_SSE2 0
+#endif
+#endif
+
+#if AUTO_SPLITTERS_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    // Calls Function for every output in the mask in ascending order, the calls are unrolled at compile time
+    template <std::uint32_t Outputs, typename FunctionType, std::size_t... AllOutputs>
+    void ForEachOutput(FunctionType&& Function, std::index_sequence<AllOutputs...>)
+    {
+        ((Outputs & (1u << AllOutputs) ? Function(static_cast<std::int32_t>(AllOutputs)) : void()), ...);
+    }
+
+    template <std::uint32_t Outputs, typename FunctionType>
+    void ForEachOutput(FunctionType&& Function)
+    {
+        ForEachOutput<Outputs>(
+            std::forward<FunctionType>(Function),
+            std::make_index_sequence<FAutoSplitterDistribution::MAX_OUTPUTS>()
+            );
+    }
+
+    constexpr std::int32_t FirstOutput(const std::uint32_t Outputs)
+    {
+        std::int32_t Output = 0;
+        while (!(Outputs & (1u << Output)))
+            ++Output;
+        return Output;
+    }
+
+    constexpr std::int32_t LastOutput(const std::uint32_t Outputs)
+    {
+        std::int32_t Output = 31;
+        while (!(Outputs & (1u << Output)))
+            --Output;
+        return Output;
+    }
+
+    constexpr std::int32_t CountOutputs(const std::uint32_t Outputs)
+    {
+        return Outputs != 0 ? static_cast<std::int32_t>(Outputs & 1u) + CountOutputs(Outputs >> 1) : 0;
+    }
+
+#if AUTO_SPLITTERS_SSE2
+    constexpr std::int32_t SSE2_LANES = 4;
+
+    // SelectOutput() for the first Chunks * 4 outputs, four at a time. The priorities are computed exactly like the
+    // scalar version, so both always pick the same output.
+    template <std::int32_t Chunks>
+    std::int32_t SelectOutputSSE2(const std::int32_t* AssignableItems, const float* StepSizes, const std::uint32_t Excluded)
+    {
+        constexpr std::int32_t LANES = SSE2_LANES;
+        static_assert(Chunks * LANES <= FAutoSplitterDistribution::MAX_OUTPUTS,"chunks must not read past the outputs");
+
+        // load straight from the arrays, staging the values in scalar stores would stall the vector loads
+        const __m128 NoPriority = _mm_set1_ps(-std::numeric_limits<float>::infinity());
+        const __m128i LaneBits = _mm_setr_epi32(1,2,4,8);
+        __m128 Eligible[Chunks];
+        __m128 Priorities[Chunks];
+        __m128 Max = NoPriority;
+        for (std::int32_t Chunk = 0 ; Chunk < Chunks ; ++Chunk)
+        {
+            const __m128i ItemVector = _mm_loadu_si128(reinterpret_cast<const __m128i*>(AssignableItems + Chunk * LANES));
+            const __m128i ExcludedLanes = _mm_cmpeq_epi32(
+                _mm_and_si128(_mm_set1_epi32(static_cast<std::int32_t>(Excluded >> (Chunk * LANES))),LaneBits),
+                LaneBits
+                );
+            Eligible[Chunk] = _mm_castsi128_ps(_mm_andnot_si128(
+                ExcludedLanes,
+                _mm_cmpgt_epi32(ItemVector,_mm_setzero_si128())
+                ));
+            Priorities[Chunk] = _mm_or_ps(
+                _mm_and_ps(Eligible[Chunk],_mm_mul_ps(_mm_cvtepi32_ps(ItemVector),_mm_loadu_ps(StepSizes + Chunk * LANES))),
+                _mm_andnot_ps(Eligible[Chunk],NoPriority)
+                );
+            Max = _mm_max_ps(Max,Priorities[Chunk]);
+        }
+
+        Max = _mm_max_ps(Max,_mm_shuffle_ps(Max,Max,_MM_SHUFFLE(2,3,0,1)));
+        Max = _mm_max_ps(Max,_mm_shuffle_ps(Max,Max,_MM_SHUFFLE(1,0,3,2)));
+
+        // lowest lane of a movemask result
+        static constexpr std::int8_t FIRST_LANE[16] = {-1,0,1,0,2,0,1,0,3,0,1,0,2,0,1,0};
+        for (std::int32_t Chunk = 0 ; Chunk < Chunks ; ++Chunk)
+        {
+            const auto Best = _mm_movemask_ps(_mm_and_ps(Eligible[Chunk],_mm_cmpeq_ps(Priorities[Chunk],Max)));
+            if (Best != 0)
+                return Chunk * LANES + FIRST_LANE[Best];
+        }
+        return -1;
+    }
+#endif
+
+    template <std::size_t... Masks>
+    constexpr std::array<FAutoSplitterDistribution::FAssignKernel,sizeof...(Masks)> MakeAssignKernels(
+        std::index_sequence<Masks...>
+        )
+    {
+        return {{&FAutoSplitterDistribution::AssignItemsFor<static_cast<std::uint32_t>(Masks)>...}};
+    }
+
+    // standard splitters get a kernel for every combination of active outputs
+    constexpr std::int32_t SPECIALIZED_OUTPUTS = 3;
+    constexpr auto ASSIGN_KERNELS = MakeAssignKernels(std::make_index_sequence<1u << SPECIALIZED_OUTPUTS>());
+
+    FAutoSplitterDistribution::FAssignKernel GetAssignKernel(const std::uint32_t ActiveOutputs)
+    {
+        if (ActiveOutputs < ASSIGN_KERNELS.size())
+            return ASSIGN_KERNELS[ActiveOutputs];
+        return &FAutoSplitterDistribution::AssignItemsFor<FAutoSplitterDistribution::ALL_OUTPUTS>;
+    }
+}
+
+FAutoSplitterDistribution::FAutoSplitterDistribution()
+    : ActiveOutputs(0)
+    , Mode(EMode::Cycles)
+    , AssignKernel(ASSIGN_KERNELS[0])
+    , ScheduleLength(0)
+    , ScheduleCursor(0)
+    , LeftInCycle(0)
+    , CycleLength(0)
+    , ReallyGrabbed(0)
+    , PenalizedItems(0)
+    , CycleTime(0.0f)
+    , ItemRate(0.0f)
+{
+    ItemsPerCycle.fill(0);
+    LeftInCycleForOutputs.fill(0);
+    BlockedFor.fill(0.0f);
+    AssignedItems.fill(0);
+    GrabbedItems.fill(0);
+    HandedOutItems.fill(0);
+    PriorityStepSize.fill(0.0f);
+    TokenRates.fill(0);
+    Tokens.fill(0);
+    for (auto& Queue : ReadyQueue)
+        Queue.fill(0);
+    ReadyHead.fill(0);
+    ReadyCount.fill(0);
+    for (auto& Steps : ReadySteps)
+        Steps.fill(0);
+    Schedule.fill(0);
+}
+
+FAutoSplitterDistribution::ESetupResult FAutoSplitterDistribution::Setup(
+    const std::uint32_t ConnectedOutputs,
+    const std::int32_t* OutputRates,
+    const bool LoadingSave
+    )
+{
+    const auto OldItemsPerCycle = ItemsPerCycle;
+    const auto OldCycleLength = CycleLength;
+
+    ActiveOutputs = 0;
+    for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+    {
+        if ((ConnectedOutputs & (1u << i)) && OutputRates[i] > 0)
+            ActiveOutputs |= 1u << i;
+    }
+    AssignKernel = GetAssignKernel(ActiveOutputs);
+
+    if (ConnectedOutputs == 0)
+    {
+        ItemsPerCycle.fill(0);
+        ScheduleLength = 0;
+        return ESetupResult::NothingConnected;
+    }
+
+    if (Mode == EMode::TokenBuckets)
+    {
+        // Outputs keep their tokens across rate changes, so the distribution carries on without a hiccup. Clearing
+        // the step sizes makes sure the cycle state gets reset when switching back to cycles.
+        for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+        {
+            TokenRates[i] = IsOutputActive(i) ? OutputRates[i] : 0;
+            if (!IsOutputActive(i))
+                Tokens[i] = 0;
+        }
+        ItemsPerCycle.fill(0);
+        LeftInCycleForOutputs.fill(0);
+        PriorityStepSize.fill(0.0f);
+        LeftInCycle = 0;
+        CycleLength = 0;
+        ScheduleLength = 0;
+        AssignKernel = &FAutoSplitterDistribution::AssignTokens;
+        return ActiveOutputs != 0 ? ESetupResult::Ready : ESetupResult::NothingToDistribute;
+    }
+
+    // start from scratch when switching to token buckets again
+    TokenRates.fill(0);
+    Tokens.fill(0);
+
+    // calculate item counts per cycle
+    for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+    {
+        ItemsPerCycle[i] = (ConnectedOutputs & (1u << i)) ? OutputRates[i] : 0;
+    }
+
+    const auto GCD = std::accumulate(
+        ItemsPerCycle.begin(),
+        ItemsPerCycle.end(),
+        0,
+        [](auto a, auto b) { return std::gcd(a,b);}
+        );
+
+    if (GCD == 0)
+    {
+        ScheduleLength = 0;
+        return ESetupResult::NothingToDistribute;
+    }
+
+    for (auto& Item : ItemsPerCycle)
+        Item /= GCD;
+
+    CycleLength = 0;
+    bool Changed = false;
+    for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+    {
+        float StepSize = 0.0f;
+        if (ConnectedOutputs & (1u << i))
+        {
+            CycleLength += ItemsPerCycle[i];
+            if (ItemsPerCycle[i] > 0)
+            {
+                StepSize = 1.0f/ItemsPerCycle[i];
+            }
+        }
+        // disconnected outputs get disabled by a zero step size
+        if (PriorityStepSize[i] != StepSize)
+        {
+            PriorityStepSize[i] = StepSize;
+            Changed = true;
+        }
+    }
+
+    BuildSchedule();
+
+    if (Changed && !LoadingSave)
+    {
+        if (OldCycleLength > 0)
+        {
+            RescaleCycle(OldItemsPerCycle,OldCycleLength);
+        }
+        else
+        {
+            LeftInCycleForOutputs.fill(0);
+            LeftInCycle = 0;
+            PrepareCycle(false,false);
+        }
+    }
+
+    return ESetupResult::Ready;
+}
+
+FAutoSplitterDistribution::ECycleAdjustment FAutoSplitterDistribution::PrepareCycle(
+    const bool AllowCycleExtension,
+    const bool Reset
+    )
+{
+    auto Adjustment = ECycleAdjustment::None;
+
+    if (!Reset && CycleTime > 0.0f)
+    {
+        // update statistics
+        if (ItemRate > 0.0f)
+        {
+            ItemRate = EXPONENTIAL_AVERAGE_WEIGHT * 60 * ReallyGrabbed / CycleTime + (1.0f - EXPONENTIAL_AVERAGE_WEIGHT) * ItemRate;
+        }
+        else
+        {
+            // bootstrap
+            ItemRate = 60.0f * ReallyGrabbed / CycleTime;
+        }
+
+        if (Mode == EMode::TokenBuckets)
+        {
+            // nothing to adapt
+        }
+        else if (AllowCycleExtension && CycleTime < MIN_CYCLE_TIME)
+        {
+            CycleLength *= 2;
+            for (auto& Items : ItemsPerCycle)
+                Items *= 2;
+            Adjustment = ECycleAdjustment::Extended;
+        }
+        else if (CycleTime > MAX_CYCLE_TIME)
+        {
+            bool CanShortenCycle = !(CycleLength & 1);
+            for (const auto Items : ItemsPerCycle)
+                CanShortenCycle = CanShortenCycle && !(Items & 1);
+
+            if (CanShortenCycle)
+            {
+                CycleLength /= 2;
+                for (auto& Items : ItemsPerCycle)
+                    Items /= 2;
+                Adjustment = ECycleAdjustment::Shortened;
+            }
+        }
+    }
+
+    CycleTime = 0.0f;
+    ReallyGrabbed = 0;
+    ScheduleCursor = 0;
+
+    if (Reset)
+    {
+        LeftInCycle = CycleLength;
+
+        for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+        {
+            LeftInCycleForOutputs[i] = IsOutputActive(i) ? ItemsPerCycle[i] : 0;
+        }
+    }
+    else
+    {
+        LeftInCycle += CycleLength;
+
+        for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+        {
+            if (IsOutputActive(i))
+                LeftInCycleForOutputs[i] += ItemsPerCycle[i];
+            else
+                LeftInCycleForOutputs[i] = 0;
+        }
+    }
+
+    return Adjustment;
+}
+
+void FAutoSplitterDistribution::BuildSchedule()
+{
+    ScheduleCursor = 0;
+
+    if (CycleLength <= 0 || CycleLength > MAX_SCHEDULE_LENGTH)
+    {
+        ScheduleLength = 0;
+        return;
+    }
+
+    // Every output gains its weight per step and the output with the highest credit pays for the whole cycle. Doubling
+    // or halving the cycle repeats the same order, so the schedule stays valid across cycle length adaptation.
+    std::array<std::int32_t,MAX_OUTPUTS> Credit = {};
+    for (std::int32_t Step = 0 ; Step < CycleLength ; ++Step)
+    {
+        std::int32_t Best = -1;
+        for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+        {
+            if (PriorityStepSize[i] == 0.0f)
+                continue;
+            Credit[i] += ItemsPerCycle[i];
+            if (Best < 0 || Credit[i] > Credit[Best])
+                Best = i;
+        }
+        Credit[Best] -= CycleLength;
+        Schedule[Step] = static_cast<std::uint8_t>(Best);
+    }
+    ScheduleLength = CycleLength;
+}
+
+void FAutoSplitterDistribution::RescaleCycle(
+    const std::array<std::int32_t,MAX_OUTPUTS>& OldItemsPerCycle,
+    const std::int32_t OldCycleLength
+    )
+{
+    // keep the cycle length the adaptation has settled on, the schedule repeats itself for longer cycles
+    while (CycleLength * 2 <= OldCycleLength)
+    {
+        CycleLength *= 2;
+        for (auto& Items : ItemsPerCycle)
+            Items *= 2;
+    }
+
+    // outputs that were not part of the old cycle join at the progress of the whole cycle
+    const float RemainingInCycle = std::clamp(static_cast<float>(LeftInCycle) / OldCycleLength,0.0f,1.0f);
+
+    LeftInCycle = 0;
+    for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+    {
+        if (!IsOutputActive(i))
+        {
+            LeftInCycleForOutputs[i] = 0;
+            continue;
+        }
+
+        float Remaining = RemainingInCycle;
+        if (OldItemsPerCycle[i] > 0)
+        {
+            Remaining = std::clamp(static_cast<float>(LeftInCycleForOutputs[i]) / OldItemsPerCycle[i],-1.0f,1.0f);
+        }
+
+        LeftInCycleForOutputs[i] = static_cast<std::int32_t>(std::lround(Remaining * ItemsPerCycle[i]));
+        LeftInCycle += LeftInCycleForOutputs[i];
+    }
+}
+
+std::int32_t FAutoSplitterDistribution::SelectOutput(
+    const std::array<std::int32_t,MAX_OUTPUTS>& AssignableItems,
+    const std::uint32_t Excluded
+    ) const
+{
+#if AUTO_SPLITTERS_SSE2
+    return SelectOutputSSE2<(MAX_OUTPUTS + SSE2_LANES - 1) / SSE2_LANES>(
+        AssignableItems.data(),
+        PriorityStepSize.data(),
+        Excluded
+        );
+#else
+    return SelectOutputScalar(AssignableItems,Excluded);
+#endif
+}
+
+std::int32_t FAutoSplitterDistribution::SelectOutputScalar(
+    const std::array<std::int32_t,MAX_OUTPUTS>& AssignableItems,
+    const std::uint32_t Excluded
+    ) const
+{
+    std::int32_t Next = -1;
+    float Priority = -std::numeric_limits<float>::infinity();
+    for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+    {
+        if ((Excluded & (1u << i)) || AssignableItems[i] <= 0)
+            continue;
+
+        const auto ItemPriority = AssignableItems[i] * PriorityStepSize[i];
+        if (ItemPriority > Priority)
+        {
+            Next = i;
+            Priority = ItemPriority;
+        }
+    }
+    return Next;
+}
+
+void FAutoSplitterDistribution::BeginTick()
+{
+    CommitGrabs();
+
+    // the schedule has been handed out up to the first item that is still waiting for its output
+    std::int32_t Steps = std::numeric_limits<std::int32_t>::max();
+    for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+    {
+        Steps = std::min<std::int32_t>(Steps,ReadySteps[i][ReadyHead[i]]);
+        ReadySteps[i][0] = 0;
+    }
+    if (ScheduleLength > 0)
+        ScheduleCursor = (ScheduleCursor + Steps) % ScheduleLength;
+
+    ReadyHead.fill(0);
+    ReadyCount.fill(0);
+
+    for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+    {
+        if (Mode == EMode::Cycles)
+            LeftInCycle -= GrabbedItems[i];
+        GrabbedItems[i] = 0;
+        AssignedItems[i] = 0;
+    }
+}
+
+template <std::uint32_t Outputs>
+std::int32_t FAutoSplitterDistribution::SelectOutputFor(
+    const std::array<std::int32_t,MAX_OUTPUTS>& AssignableItems,
+    const std::uint32_t Excluded
+    ) const
+{
+    if constexpr (Outputs == 0)
+    {
+        return -1;
+    }
+    else if constexpr ((Outputs & (Outputs - 1)) == 0)
+    {
+        // a single output always has the highest priority while it has assignable items
+        constexpr std::int32_t Output = FirstOutput(Outputs);
+        return !(Excluded & Outputs) && AssignableItems[Output] > 0 ? Output : -1;
+    }
+#if AUTO_SPLITTERS_SSE2
+    else if constexpr (CountOutputs(Outputs) >= 3)
+    {
+        // only load the chunks that hold outputs of the mask
+        return SelectOutputSSE2<LastOutput(Outputs) / SSE2_LANES + 1>(
+            AssignableItems.data(),
+            PriorityStepSize.data(),
+            Excluded | (ALL_OUTPUTS & ~Outputs)
+            );
+    }
+#endif
+    else
+    {
+        std::int32_t Next = -1;
+        float Priority = -std::numeric_limits<float>::infinity();
+        ForEachOutput<Outputs>([&](const std::int32_t i)
+        {
+            if ((Excluded & (1u << i)) || AssignableItems[i] <= 0)
+                return;
+
+            const auto ItemPriority = AssignableItems[i] * PriorityStepSize[i];
+            if (ItemPriority > Priority)
+            {
+                Next = i;
+                Priority = ItemPriority;
+            }
+        });
+        return Next;
+    }
+}
+
+template <std::uint32_t Outputs>
+std::int32_t FAutoSplitterDistribution::AssignItemsFor(
+    const std::int32_t* PopulatedSlots,
+    const std::int32_t SlotCount,
+    const float dt
+    )
+{
+    std::array<std::int32_t,MAX_OUTPUTS> AssignableItems = {};
+    std::array<std::int32_t,MAX_OUTPUTS> Queued = {};
+
+    // only the shared kernel for wide splitters sees outputs that are not active
+    const std::uint32_t Inactive = Outputs & ~ActiveOutputs;
+
+    std::int32_t Unassigned = 0;
+    PenalizedItems = 0;
+
+    // all items get assigned again on every tick, so only BeginTick() moves the real cursor
+    std::int32_t Cursor = ScheduleCursor;
+    std::int32_t Steps = 0;
+
+    const auto Assign = [&](const std::int32_t Output, const std::int32_t Slot)
+    {
+        ReadySteps[Output][Queued[Output]] = static_cast<std::uint8_t>(Steps);
+        ReadyQueue[Output][Queued[Output]++] = static_cast<std::uint8_t>(Slot);
+        ++AssignedItems[Output];
+    };
+
+    for (std::int32_t ActiveSlot = 0 ; ActiveSlot < SlotCount ; ++ActiveSlot)
+    {
+        // steady state: follow the precomputed schedule as long as the scheduled output can take the item
+        if (ScheduleLength > 0)
+        {
+            const std::int32_t Scheduled = Schedule[Cursor];
+            const bool Exhausted = LeftInCycleForOutputs[Scheduled] - AssignedItems[Scheduled] + GrabbedItems[Scheduled] <= 0;
+            if (Exhausted || !IsOutputBlocked(Scheduled))
+            {
+                if (!Exhausted)
+                    Assign(Scheduled,PopulatedSlots[ActiveSlot]);
+
+                Cursor = Cursor + 1 < ScheduleLength ? Cursor + 1 : 0;
+                ++Steps;
+                if (!Exhausted)
+                    continue;
+            }
+        }
+
+        ForEachOutput<Outputs>([&](const std::int32_t i)
+        {
+            // Adding the grabbed items in the next line de-skews the algorithm if the output has been
+            // penalized for an earlier inventory slot
+            AssignableItems[i] = LeftInCycleForOutputs[i] - AssignedItems[i] + GrabbedItems[i];
+        });
+        std::int32_t Next = SelectOutputFor<Outputs>(AssignableItems,Inactive);
+
+        if (Next < 0)
+        {
+            break;
+        }
+
+        std::uint32_t Penalized = Inactive;
+        while (Next >= 0 && IsOutputBlocked(Next))
+        {
+            Penalized |= 1u << Next;
+            ++PenalizedItems;
+            --LeftInCycleForOutputs[Next];
+            ++AssignedItems[Next];
+            ++GrabbedItems[Next]; // this is a blatant lie, but it will cause the correct update of LeftInCycle during the next tick
+            --AssignableItems[Next];
+            Next = SelectOutputFor<Outputs>(AssignableItems,Penalized);
+        }
+
+        if (Next >= 0)
+        {
+            Assign(Next,PopulatedSlots[ActiveSlot]);
+        }
+        else
+        {
+            // all eligible outputs blocked
+            ++Unassigned;
+        }
+    }
+
+    ForEachOutput<Outputs>([&](const std::int32_t i)
+    {
+        // Checking for GrabbedItems seems weird, but that catches stuck outputs
+        // that have been penalized
+        if (AssignedItems[i] > 0 || GrabbedItems[i] > 0)
+        {
+            BlockedFor[i] += dt;
+        }
+    });
+
+    for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+    {
+        ReadySteps[i][Queued[i]] = static_cast<std::uint8_t>(Steps);
+    }
+
+    // make new items available to outputs
+    ReadyCount = Queued;
+
+    return Unassigned;
+}
+
+void FAutoSplitterDistribution::CommitTokens()
+{
+    std::int64_t HandedOut = 0;
+    for (const auto Items : HandedOutItems)
+        HandedOut += Items;
+
+    if (HandedOut == 0)
+        return;
+
+    // Blocked outputs keep their tokens instead of piling them up. Every item costs exactly what it earned the other
+    // outputs, so the tokens of the earning outputs always add up to the same value and stay bounded.
+    std::uint32_t Earning = 0;
+    std::int64_t EarningRate = 0;
+    for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+    {
+        if (IsOutputActive(i) && (!IsOutputBlocked(i) || HandedOutItems[i] > 0))
+        {
+            Earning |= 1u << i;
+            EarningRate += TokenRates[i];
+        }
+    }
+
+    for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+    {
+        if (Earning & (1u << i))
+            Tokens[i] += HandedOut * TokenRates[i] - HandedOutItems[i] * EarningRate;
+
+        HandedOutItems[i] = 0;
+    }
+
+    ReallyGrabbed += static_cast<std::int32_t>(HandedOut);
+}
+
+std::int32_t FAutoSplitterDistribution::AssignTokens(
+    const std::int32_t* PopulatedSlots,
+    const std::int32_t SlotCount,
+    const float dt
+    )
+{
+    std::array<std::int32_t,MAX_OUTPUTS> Queued = {};
+    std::int32_t Unassigned = 0;
+    PenalizedItems = 0;
+
+    std::uint32_t Eligible = 0;
+    std::int64_t EligibleRate = 0;
+    for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+    {
+        if (IsOutputActive(i) && !IsOutputBlocked(i))
+        {
+            Eligible |= 1u << i;
+            EligibleRate += TokenRates[i];
+        }
+    }
+
+    if (Eligible == 0)
+    {
+        // all eligible outputs blocked
+        Unassigned = ActiveOutputs != 0 ? SlotCount : 0;
+    }
+    else
+    {
+        // items that are not grabbed during this tick have not cost anything, so work on a copy of the tokens
+        auto Credit = Tokens;
+        for (std::int32_t ActiveSlot = 0 ; ActiveSlot < SlotCount ; ++ActiveSlot)
+        {
+            std::int32_t Next = -1;
+            for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+            {
+                if (!(Eligible & (1u << i)))
+                    continue;
+
+                Credit[i] += TokenRates[i];
+                if (Next < 0 || Credit[i] > Credit[Next])
+                    Next = i;
+            }
+            Credit[Next] -= EligibleRate;
+
+            ReadyQueue[Next][Queued[Next]++] = static_cast<std::uint8_t>(PopulatedSlots[ActiveSlot]);
+            ++AssignedItems[Next];
+        }
+    }
+
+    for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+    {
+        if (AssignedItems[i] > 0 || GrabbedItems[i] > 0)
+        {
+            BlockedFor[i] += dt;
+        }
+    }
+
+    // make new items available to outputs
+    ReadyCount = Queued;
+
+    return Unassigned;
+}
@@ -0,0 +1,289 @@
+// ILikeBanas
+
+#include "Distribution/AutoSplitterNetworkGraph.h"
+
+#include <limits>
+#include <numeric>
+
+void FAutoSplitterNetworkGraph::Reset()
+{
+    Input.clear();
+    Outputs.clear();
+    MaxInputRate.clear();
+    MaxOutputRates.clear();
+    PotentialShares.clear();
+    ManualInputRate.clear();
+    TargetInputRate.clear();
+    OutputRates.clear();
+    AutomaticOutputs.clear();
+    OutputStates.clear();
+    FixedDemand.clear();
+    Shares.clear();
+    AllocatedInputRate.clear();
+    AllocatedOutputRates.clear();
+    RateRounding.clear();
+    ConnectionStateChanged.clear();
+}
+
+void FAutoSplitterNetworkGraph::Reserve(const std::int32_t Nodes)
+{
+    Input.reserve(Nodes);
+    Outputs.reserve(Nodes);
+    MaxInputRate.reserve(Nodes);
+    MaxOutputRates.reserve(Nodes);
+    PotentialShares.reserve(Nodes);
+    ManualInputRate.reserve(Nodes);
+    TargetInputRate.reserve(Nodes);
+    OutputRates.reserve(Nodes);
+    AutomaticOutputs.reserve(Nodes);
+    OutputStates.reserve(Nodes);
+    FixedDemand.reserve(Nodes);
+    Shares.reserve(Nodes);
+    AllocatedInputRate.reserve(Nodes);
+    AllocatedOutputRates.reserve(Nodes);
+    RateRounding.reserve(Nodes);
+    ConnectionStateChanged.reserve(Nodes);
+}
+
+std::int32_t FAutoSplitterNetworkGraph::AddNode(const std::int32_t InputNode, const std::int32_t ChildInParent)
+{
+    const auto Node = Num();
+
+    FOutputNodes NoOutputs;
+    NoOutputs.fill(NO_NODE);
+
+    Input.push_back(InputNode);
+    Outputs.push_back(NoOutputs);
+    MaxInputRate.push_back(InputNode != NO_NODE ? MaxOutputRates[InputNode][ChildInParent] : 0);
+    MaxOutputRates.push_back({});
+    PotentialShares.push_back({});
+    ManualInputRate.push_back(false);
+    TargetInputRate.push_back(0);
+    OutputRates.push_back({});
+    AutomaticOutputs.push_back(0);
+    OutputStates.push_back({});
+    FixedDemand.push_back(0);
+    Shares.push_back(0);
+    AllocatedInputRate.push_back(0);
+    AllocatedOutputRates.push_back({});
+    RateRounding.push_back({});
+    ConnectionStateChanged.push_back(false);
+
+    if (InputNode != NO_NODE)
+        Outputs[InputNode][ChildInParent] = Node;
+
+    return Node;
+}
+
+void FAutoSplitterNetworkGraph::AggregateNode(const std::int32_t Node)
+{
+    FixedDemand[Node] = 0;
+    Shares[Node] = 0;
+
+    for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+    {
+        if (MaxOutputRates[Node][i] == 0)
+            continue;
+
+        const auto Output = Outputs[Node][i];
+        if (Output != NO_NODE)
+        {
+            if (ManualInputRate[Output])
+            {
+                FixedDemand[Node] += TargetInputRate[Output];
+            }
+            else
+            {
+                Shares[Node] += Shares[Output];
+                FixedDemand[Node] += FixedDemand[Output];
+            }
+        }
+        else if (IsOutputAutomatic(Node,i))
+        {
+            Shares[Node] += PotentialShares[Node][i];
+        }
+        else
+        {
+            FixedDemand[Node] += OutputRates[Node][i];
+        }
+    }
+}
+
+FAutoSplitterNetworkGraph::EAllocationResult FAutoSplitterNetworkGraph::AllocateNode(const std::int32_t Node)
+{
+    auto& Rates = AllocatedOutputRates[Node];
+    Rates.fill(0);
+    RateRounding[Node].fill(0);
+
+    if (MaxInputRate[Node] < FixedDemand[Node])
+        return EAllocationResult::ExceedsMaxInputRate;
+
+    const std::int32_t AvailableForShares = AllocatedInputRate[Node] - FixedDemand[Node];
+    if (AvailableForShares < 0)
+        return EAllocationResult::ExceedsInputRate;
+
+    // fixed demand first, the outputs with shares get their part of the rest on top
+    FOutputShares OutputShares = {};
+    for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+    {
+        if (MaxOutputRates[Node][i] == 0)
+            continue;
+
+        const auto Output = Outputs[Node][i];
+        if (Output != NO_NODE)
+        {
+            if (ManualInputRate[Output])
+            {
+                Rates[i] = TargetInputRate[Output];
+            }
+            else
+            {
+                Rates[i] = FixedDemand[Output];
+                OutputShares[i] = Shares[Output];
+            }
+        }
+        else
+        {
+            if (IsOutputAutomatic(Node,i))
+            {
+                OutputShares[i] = PotentialShares[Node][i];
+            }
+            else
+            {
+                Rates[i] = OutputRates[Node][i];
+            }
+        }
+    }
+
+    ApportionShares(Node,AvailableForShares,OutputShares);
+
+    for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+    {
+        const auto Output = Outputs[Node][i];
+        if (Output != NO_NODE)
+            AllocatedInputRate[Output] = Rates[i];
+    }
+
+    return EAllocationResult::Ready;
+}
+
+void FAutoSplitterNetworkGraph::ApportionShares(
+    const std::int32_t Node,
+    const std::int32_t Available,
+    const FOutputShares& OutputShares
+    )
+{
+    auto& Rates = AllocatedOutputRates[Node];
+
+    std::int64_t TotalShares = 0;
+    for (const auto OutputShare : OutputShares)
+        TotalShares += OutputShare;
+
+    if (TotalShares <= 0)
+        return;
+
+    // every output gets its exact quota rounded down, the units left over go to outputs that have a remainder
+    FOutputShares Remainders = {};
+    std::array<std::int32_t,MAX_OUTPUTS> Candidates;
+    std::int32_t NumCandidates = 0;
+    std::int64_t LeftOver = Available;
+    for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+    {
+        if (OutputShares[i] <= 0)
+            continue;
+
+        const std::int64_t Quota = static_cast<std::int64_t>(Available) * OutputShares[i];
+        Rates[i] += static_cast<std::int32_t>(Quota / TotalShares);
+        Remainders[i] = Quota % TotalShares;
+        LeftOver -= Quota / TotalShares;
+        if (Remainders[i] > 0)
+            Candidates[NumCandidates++] = i;
+    }
+
+    // The remainders add up to LeftOver units, so there are at least that many candidates. Rounding up any LeftOver
+    // of them keeps every output within one unit of its quota. Prefer the choice with the shortest cycle, and the
+    // largest remainders among those.
+    std::uint32_t RoundUp = 0;
+    if (LeftOver > 0)
+    {
+        std::int64_t BestCycleLength = std::numeric_limits<std::int64_t>::max();
+        std::int64_t BestRemainders = -1;
+        for (std::uint32_t Choice = 0 ; Choice < (1u << NumCandidates) ; ++Choice)
+        {
+            std::uint32_t RoundedOutputs = 0;
+            std::int64_t RoundedRemainders = 0;
+            std::int32_t Chosen = 0;
+            for (std::int32_t c = 0 ; c < NumCandidates ; ++c)
+            {
+                if (Choice & (1u << c))
+                {
+                    RoundedOutputs |= 1u << Candidates[c];
+                    RoundedRemainders += Remainders[Candidates[c]];
+                    ++Chosen;
+                }
+            }
+
+            if (Chosen != LeftOver)
+                continue;
+
+            std::int64_t Sum = 0;
+            std::int32_t GCD = 0;
+            for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+            {
+                const std::int32_t Rate = Rates[i] + ((RoundedOutputs & (1u << i)) ? 1 : 0);
+                if (Rate > 0)
+                {
+                    Sum += Rate;
+                    GCD = std::gcd(GCD,Rate);
+                }
+            }
+
+            const std::int64_t CycleLength = Sum / GCD;
+            if (CycleLength < BestCycleLength || (CycleLength == BestCycleLength && RoundedRemainders > BestRemainders))
+            {
+                BestCycleLength = CycleLength;
+                BestRemainders = RoundedRemainders;
+                RoundUp = RoundedOutputs;
+            }
+        }
+    }
+
+    for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+    {
+        if (OutputShares[i] <= 0)
+            continue;
+
+        std::int64_t Rounding = -Remainders[i];
+        if (RoundUp & (1u << i))
+        {
+            ++Rates[i];
+            Rounding += TotalShares;
+        }
+        RateRounding[Node][i] = Rounding * FRACTIONAL_SHARE_MULTIPLIER / TotalShares;
+    }
+}
+
+FAutoSplitterNetworkGraph::EAllocationResult FAutoSplitterNetworkGraph::Solve(std::int32_t& FailedNode)
+{
+    // every node is stored after its input, so going backwards sums up all outputs before their input
+    for (std::int32_t Node = Num() - 1 ; Node >= 0 ; --Node)
+    {
+        AggregateNode(Node);
+    }
+
+    if (Num() > 0)
+        AllocatedInputRate[0] = TargetInputRate[0];
+
+    for (std::int32_t Node = 0 ; Node < Num() ; ++Node)
+    {
+        const auto Result = AllocateNode(Node);
+        if (Result != EAllocationResult::Ready)
+        {
+            FailedNode = Node;
+            return Result;
+        }
+    }
+
+    FailedNode = NO_NODE;
+    return EAllocationResult::Ready;
+}
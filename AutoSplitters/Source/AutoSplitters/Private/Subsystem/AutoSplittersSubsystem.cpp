@@ -2,20 +2,53 @@
 
 
 #include "Subsystem/AutoSplittersSubsystem.h"
+
+#include <algorithm>
+
 #include "ModLoading/ModLoadingLibrary.h"
 #include "AutoSplittersLog.h"
+#include "AutoSplittersStats.h"
+#include "FGFactoryConnectionComponent.h"
+#include "Buildables/FGBuildableConveyorBase.h"
+#include "EngineUtils.h"
+#include "HAL/IConsoleManager.h"
+#include "Async/ParallelFor.h"
+#include "Misc/ScopeLock.h"
+#include "Misc/ScopeRWLock.h"
 
 AAutoSplittersSubsystem* AAutoSplittersSubsystem::sCachedSubsystem = nullptr;
 
 const FVersion AAutoSplittersSubsystem::New_Session = FVersion(INT32_MAX,INT32_MAX,INT32_MAX);
 const FVersion AAutoSplittersSubsystem::ModVersion_Legacy = FVersion(0,0,0);
 
+static TAutoConsoleVariable<float> GAutoSplittersBalancingBudget(
+    TEXT("AutoSplitters.BalancingBudgetMs"),
+    1.0f,
+    TEXT("Time in milliseconds the server may spend per frame on balancing queued Auto Splitter networks. Larger networks are balanced over several frames, 0 disables the limit.")
+    );
+
+static TAutoConsoleVariable<bool> GAutoSplittersAsyncBalancing(
+    TEXT("AutoSplitters.AsyncBalancing"),
+    true,
+    TEXT("Solve queued Auto Splitter networks on a worker thread and apply the results on a later frame.")
+    );
+
+static TAutoConsoleVariable<bool> GAutoSplittersParallelBalancing(
+    TEXT("AutoSplitters.ParallelBalancing"),
+    true,
+    TEXT("Work on the balancing jobs of independent Auto Splitter networks in parallel.")
+    );
+
 AAutoSplittersSubsystem::AAutoSplittersSubsystem()
     : mLoadedModVersion(New_Session) // marker for new session
     , mSerializationVersion(EAutoSplittersSerializationVersion::Legacy)
     , mIsNewSession(false)
+    , mStatisticsResetTime(0.0f)
+    , mTopologyGeneration(1)
+    , mConveyorChainsGeneration(0)
 {
     ReplicationPolicy = ESubsystemReplicationPolicy::SpawnOnServer;
+    PrimaryActorTick.bCanEverTick = true;
 }
 
 AAutoSplittersSubsystem* AAutoSplittersSubsystem::FindAndGet(UObject* WorldContext, bool FailIfMissing)
@@ -97,10 +130,241 @@ void AAutoSplittersSubsystem::Init()
 void AAutoSplittersSubsystem::EndPlay(const EEndPlayReason::Type EndPlayReason)
 {
     Super::EndPlay(EndPlayReason);
+    mBalancingQueue.Empty();
+    mBalancingJobs.Empty();
+    mNetworks.Empty();
+    mSpareNetworks.Empty();
+    mConveyorChains.Empty();
     if (this == sCachedSubsystem)
         sCachedSubsystem = nullptr;
 }
 
+void AAutoSplittersSubsystem::Tick(float DeltaSeconds)
+{
+    Super::Tick(DeltaSeconds);
+
+    if (HasAuthority())
+    {
+        ProcessBalancingQueue();
+        RunBalancingJobs();
+    }
+}
+
+void AAutoSplittersSubsystem::RequestBalancing(AMFGBuildableAutoSplitter* Splitter)
+{
+    Splitter->mBalancingQueued = true;
+    FScopeLock Lock(&mBalancingQueueLock);
+    mBalancingQueue.Add(Splitter);
+}
+
+void AAutoSplittersSubsystem::ProcessBalancingQueue()
+{
+    TArray<TWeakObjectPtr<AMFGBuildableAutoSplitter>> Queue;
+    {
+        FScopeLock Lock(&mBalancingQueueLock);
+        Swap(Queue,mBalancingQueue);
+    }
+
+    if (Queue.Num() == 0)
+        return;
+
+    TSet<AMFGBuildableAutoSplitter*> Roots;
+    for (const auto& Job : mBalancingJobs)
+    {
+        Roots.Add(Job.Root.Get());
+    }
+
+    int32 Waiting = 0;
+    for (int32 i = 0 ; i < Queue.Num() ; ++i)
+    {
+        const auto Splitter = Queue[i].Get();
+        if (!Splitter)
+            continue;
+
+        // a full run clears the request of every splitter in the network
+        if (!Splitter->mBalancingRequired)
+        {
+            Splitter->mBalancingQueued = false;
+            continue;
+        }
+
+        // requests for a network with a job in progress wait until the job has reached them
+        const auto Root = AMFGBuildableAutoSplitter::FindNetworkRoot(Splitter);
+        if (Roots.Contains(Root))
+        {
+            Queue[Waiting++] = Queue[i];
+            continue;
+        }
+        Roots.Add(Root);
+
+        Splitter->mBalancingQueued = false;
+        AMFGBuildableAutoSplitter::FBalancingJob Job;
+        Job.SolveAsync = GAutoSplittersAsyncBalancing.GetValueOnGameThread();
+        if (AMFGBuildableAutoSplitter::BeginBalancing(Job,Root,false))
+            mBalancingJobs.Add(MoveTemp(Job));
+    }
+
+    Queue.SetNum(Waiting,false);
+
+    FScopeLock Lock(&mBalancingQueueLock);
+    mBalancingQueue.Append(MoveTemp(Queue));
+}
+
+void AAutoSplittersSubsystem::RunBalancingJobs()
+{
+    if (mBalancingJobs.Num() == 0)
+        return;
+
+    const auto Budget = GAutoSplittersBalancingBudget.GetValueOnGameThread();
+    const double Deadline = Budget > 0.0f ? FPlatformTime::Seconds() + Budget / 1000.0 : 0.0;
+
+    using EPhase = AMFGBuildableAutoSplitter::FBalancingJob::EPhase;
+
+    // discovery fills the conveyor chain cache and stores networks, so it has to happen one job after the other
+    for (auto& Job : mBalancingJobs)
+    {
+        if (Deadline > 0.0 && FPlatformTime::Seconds() > Deadline)
+            break;
+        AMFGBuildableAutoSplitter::ContinueBalancing(Job,Deadline,EPhase::Snapshot);
+    }
+
+    // networks never share splitters, and from here on a job only touches its own network
+    ParallelFor(
+        mBalancingJobs.Num(),
+        [this,Deadline](const int32 Index)
+        {
+            auto& Job = mBalancingJobs[Index];
+            if (Job.Phase != EPhase::Discover)
+                AMFGBuildableAutoSplitter::ContinueBalancing(Job,Deadline);
+        },
+        !GAutoSplittersParallelBalancing.GetValueOnGameThread()
+        );
+
+    for (auto& Job : mBalancingJobs)
+    {
+        if (!Job.IsFinished())
+            continue;
+
+        // start over on the current topology
+        const auto Root = Job.Root.Get();
+        if (Job.Phase == EPhase::Stale && Root)
+        {
+            Root->mBalancingRequired = true;
+            if (!Root->mBalancingQueued)
+                RequestBalancing(Root);
+        }
+    }
+
+    mBalancingJobs.RemoveAll([](const AMFGBuildableAutoSplitter::FBalancingJob& Job)
+    {
+        return Job.IsFinished();
+    });
+}
+
+FAutoSplitterConveyorChain AAutoSplittersSubsystem::FindConveyorChain(UFGFactoryConnectionComponent* Connection, bool Forward)
+{
+    // concurrent ticks mostly look up chains, so they only need the exclusive lock to walk a new one
+    {
+        FRWScopeLock Lock(mConveyorChainsLock,SLT_ReadOnly);
+        if (mConveyorChainsGeneration == mTopologyGeneration)
+        {
+            if (const auto Chain = mConveyorChains.Find(Connection))
+                return *Chain;
+        }
+    }
+
+    FRWScopeLock Lock(mConveyorChainsLock,SLT_Write);
+
+    if (mConveyorChainsGeneration != mTopologyGeneration)
+    {
+        // stale entries might point to dismantled buildables
+        mConveyorChains.Reset();
+        mConveyorChainsGeneration = mTopologyGeneration;
+    }
+
+    if (const auto Chain = mConveyorChains.Find(Connection))
+        return *Chain;
+
+    return mConveyorChains.Add(Connection,WalkConveyorChain(Connection,Forward));
+}
+
+FAutoSplitterConveyorChain AAutoSplittersSubsystem::WalkConveyorChain(UFGFactoryConnectionComponent* Connection, bool Forward)
+{
+    AUTO_SPLITTERS_SCOPE(BeltWalk);
+
+    int32 Rate = INT32_MAX;
+    while (Connection->IsConnected())
+    {
+        Connection = Connection->GetConnection();
+        const auto Belt = Cast<AFGBuildableConveyorBase>(Connection->GetOuterBuildable());
+        if (Belt)
+        {
+            Connection = Forward ? Belt->GetConnection1() : Belt->GetConnection0();
+            Rate = std::min(Rate,static_cast<int32>(Belt->GetSpeed()) * (AMFGBuildableAutoSplitter::FRACTIONAL_RATE_MULTIPLIER / 2));
+            continue;
+        }
+        return {Connection->GetOuterBuildable(),Rate};
+    }
+    return {nullptr,0};
+}
+
+TUniquePtr<AMFGBuildableAutoSplitter::FNetwork> AAutoSplittersSubsystem::AcquireNetwork()
+{
+    if (mSpareNetworks.Num() > 0)
+        return mSpareNetworks.Pop(false);
+    return MakeUnique<AMFGBuildableAutoSplitter::FNetwork>();
+}
+
+void AAutoSplittersSubsystem::ReleaseNetwork(TUniquePtr<AMFGBuildableAutoSplitter::FNetwork>&& Network)
+{
+    Network->Reset();
+    mSpareNetworks.Add(MoveTemp(Network));
+}
+
+AMFGBuildableAutoSplitter::FNetwork& AAutoSplittersSubsystem::StoreNetwork(
+    AMFGBuildableAutoSplitter* Root,
+    TUniquePtr<AMFGBuildableAutoSplitter::FNetwork>&& Network
+    )
+{
+    // the splitters of stale networks might be gone, so only look at their generation
+    for (auto It = mNetworks.CreateIterator() ; It ; ++It)
+    {
+        if (It.Value()->Generation != mTopologyGeneration)
+        {
+            ReleaseNetwork(MoveTemp(It.Value()));
+            It.RemoveCurrent();
+        }
+    }
+
+    // a current network of the same root gets replaced, its splitters must not keep pointing into it
+    if (const auto Existing = mNetworks.Find(Root))
+    {
+        for (const auto Splitter : (*Existing)->Splitters)
+        {
+            if (Splitter->mNetwork == Existing->Get())
+            {
+                Splitter->mNetwork = nullptr;
+                Splitter->mNetworkNode = AMFGBuildableAutoSplitter::NO_NODE;
+            }
+        }
+        ReleaseNetwork(MoveTemp(*Existing));
+    }
+
+    auto& Stored = mNetworks.Add(Root,MoveTemp(Network));
+    Stored->Generation = mTopologyGeneration;
+    Stored->Balanced = false;
+
+    for (int32 Node = 0 ; Node < Stored->Num() ; ++Node)
+    {
+        const auto Splitter = Stored->Splitters[Node];
+        Splitter->mNetwork = Stored.Get();
+        Splitter->mNetworkNode = Node;
+        Splitter->mNetworkGeneration = mTopologyGeneration;
+    }
+
+    return *Stored;
+}
+
 void AAutoSplittersSubsystem::ReloadConfig()
 {
     mConfig = FAutoSplitters_ConfigStruct::GetActiveConfig();
@@ -136,6 +400,135 @@ void AAutoSplittersSubsystem::NotifyChat(ESeverity Severity, FString Msg) const
 
 }
 
+FAutoSplitterStatistics AAutoSplittersSubsystem::GetGlobalStatistics() const
+{
+    FAutoSplitterStatistics Result;
+    for (TActorIterator<AMFGBuildableAutoSplitter> It(GetWorld()) ; It ; ++It)
+    {
+        Result += It->mStatistics;
+    }
+    return Result;
+}
+
+FAutoSplitterStatistics AAutoSplittersSubsystem::GetNetworkStatistics(AMFGBuildableAutoSplitter* Splitter) const
+{
+    FAutoSplitterStatistics Result;
+    if (!Splitter || !HasAuthority())
+        return Result;
+
+    TSet<AMFGBuildableAutoSplitter*> Network;
+    AMFGBuildableAutoSplitter::CollectNetwork(Splitter,Network);
+    for (const auto NetworkSplitter : Network)
+    {
+        Result += NetworkSplitter->mStatistics;
+    }
+    return Result;
+}
+
+void AAutoSplittersSubsystem::ResetStatistics()
+{
+    for (TActorIterator<AMFGBuildableAutoSplitter> It(GetWorld()) ; It ; ++It)
+    {
+        It->mStatistics = FAutoSplitterStatistics();
+        It->mStatistics.Splitters = 1;
+    }
+    mStatisticsResetTime = GetWorld()->TimeSeconds;
+}
+
+float AAutoSplittersSubsystem::GetStatisticsTime() const
+{
+    return GetWorld()->TimeSeconds - mStatisticsResetTime;
+}
+
+static FString FormatStatistics(const FAutoSplitterStatistics& Statistics, const float Minutes)
+{
+    return FString::Printf(
+        TEXT("splitters=%d penalized=%lld blockedTicks=%lld extended=%lld shortened=%lld resets=%lld balanceRuns=%lld (%.1f/min) invalid=%lld"),
+        Statistics.Splitters,
+        Statistics.PenalizedItems,
+        Statistics.BlockedTicks,
+        Statistics.CycleExtensions,
+        Statistics.CycleShortenings,
+        Statistics.CycleResets,
+        Statistics.BalanceRuns,
+        Minutes > 0.0f ? Statistics.BalanceRuns / Minutes : 0.0f,
+        Statistics.InvalidBalanceRuns
+        );
+}
+
+void AAutoSplittersSubsystem::StatisticsCommand(const TArray<FString>& Args, UWorld* World)
+{
+    auto Subsystem = World ? Get(World,false) : nullptr;
+    if (!Subsystem || !Subsystem->HasAuthority())
+    {
+        UE_LOG(LogAutoSplitters,Warning,TEXT("AutoSplitters.Stats is only available on the server"));
+        return;
+    }
+
+    const int32 Count = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 10;
+    const float Minutes = Subsystem->GetStatisticsTime() / 60.0f;
+
+    // aggregate per network root
+    FAutoSplitterStatistics Global;
+    TArray<AMFGBuildableAutoSplitter*> Splitters;
+    TMap<AMFGBuildableAutoSplitter*,FAutoSplitterStatistics> Networks;
+    for (TActorIterator<AMFGBuildableAutoSplitter> It(World) ; It ; ++It)
+    {
+        Splitters.Add(*It);
+        Global += It->mStatistics;
+        Networks.FindOrAdd(AMFGBuildableAutoSplitter::FindNetworkRoot(*It)) += It->mStatistics;
+    }
+
+    UE_LOG(LogAutoSplitters,Display,TEXT("Auto Splitter statistics for the last %.1f minutes"),Minutes);
+    UE_LOG(LogAutoSplitters,Display,TEXT("Global: networks=%d %s"),Networks.Num(),*FormatStatistics(Global,Minutes));
+
+    Networks.ValueSort([](const FAutoSplitterStatistics& A, const FAutoSplitterStatistics& B)
+    {
+        return A.PenalizedItems + A.CycleResets > B.PenalizedItems + B.CycleResets;
+    });
+    int32 Rank = 0;
+    for (const auto& Network : Networks)
+    {
+        if (Rank++ >= Count)
+            break;
+        UE_LOG(LogAutoSplitters,Display,TEXT("Network %s: %s"),*Network.Key->GetName(),*FormatStatistics(Network.Value,Minutes));
+    }
+
+    Splitters.Sort([](const AMFGBuildableAutoSplitter& A, const AMFGBuildableAutoSplitter& B)
+    {
+        return A.mStatistics.PenalizedItems + A.mStatistics.CycleResets > B.mStatistics.PenalizedItems + B.mStatistics.CycleResets;
+    });
+    for (int32 i = 0 ; i < Count && i < Splitters.Num() ; ++i)
+    {
+        UE_LOG(LogAutoSplitters,Display,TEXT("Splitter %s: %s"),*Splitters[i]->GetName(),*FormatStatistics(Splitters[i]->mStatistics,Minutes));
+    }
+}
+
+void AAutoSplittersSubsystem::ResetStatisticsCommand(const TArray<FString>& Args, UWorld* World)
+{
+    auto Subsystem = World ? Get(World,false) : nullptr;
+    if (!Subsystem || !Subsystem->HasAuthority())
+    {
+        UE_LOG(LogAutoSplitters,Warning,TEXT("AutoSplitters.ResetStats is only available on the server"));
+        return;
+    }
+
+    Subsystem->ResetStatistics();
+    UE_LOG(LogAutoSplitters,Display,TEXT("Auto Splitter statistics reset"));
+}
+
+static FAutoConsoleCommandWithWorldAndArgs GAutoSplittersStatsCommand(
+    TEXT("AutoSplitters.Stats"),
+    TEXT("Logs the global Auto Splitter statistics and the networks and splitters with the most penalized items and cycle resets. Optional argument: number of entries (default 10)."),
+    FConsoleCommandWithWorldAndArgsDelegate::CreateStatic(&AAutoSplittersSubsystem::StatisticsCommand)
+    );
+
+static FAutoConsoleCommandWithWorldAndArgs GAutoSplittersResetStatsCommand(
+    TEXT("AutoSplitters.ResetStats"),
+    TEXT("Resets the statistics of all Auto Splitters."),
+    FConsoleCommandWithWorldAndArgsDelegate::CreateStatic(&AAutoSplittersSubsystem::ResetStatisticsCommand)
+    );
+
 void AAutoSplittersSubsystem::PreSaveGame_Implementation(int32 saveVersion, int32 gameVersion)
 {
     mLoadedModVersion = mRunningModVersion;
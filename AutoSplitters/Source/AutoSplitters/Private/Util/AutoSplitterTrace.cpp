@@ -0,0 +1,68 @@
+// ILikeBanas
+
+#include "Util/AutoSplitterTrace.h"
+
+const TCHAR* FAutoSplitterTrace::GetEventName(EAutoSplitterTraceEvent Event)
+{
+    switch (Event)
+    {
+    case EAutoSplitterTraceEvent::Assign:
+        return TEXT("Assign");
+    case EAutoSplitterTraceEvent::Blocked:
+        return TEXT("Blocked");
+    case EAutoSplitterTraceEvent::CycleExtended:
+        return TEXT("CycleExtended");
+    case EAutoSplitterTraceEvent::CycleShortened:
+        return TEXT("CycleShortened");
+    case EAutoSplitterTraceEvent::CycleReset:
+        return TEXT("CycleReset");
+    case EAutoSplitterTraceEvent::Setup:
+        return TEXT("Setup");
+    case EAutoSplitterTraceEvent::Sleep:
+        return TEXT("Sleep");
+    case EAutoSplitterTraceEvent::BalanceStart:
+        return TEXT("BalanceStart");
+    case EAutoSplitterTraceEvent::BalanceRates:
+        return TEXT("BalanceRates");
+    case EAutoSplitterTraceEvent::BalanceRemainder:
+        return TEXT("BalanceRemainder");
+    case EAutoSplitterTraceEvent::BalanceInvalid:
+        return TEXT("BalanceInvalid");
+    case EAutoSplitterTraceEvent::MoreOutputs:
+        return TEXT("MoreOutputs");
+    }
+    return TEXT("Unknown");
+}
+
+void FAutoSplitterTrace::Format(FString& Out) const
+{
+    // merge both rings by sequence, continuation records are labeled with the outputs they belong to
+    int32 FirstOutput = 3;
+    uint32 Tick = 0;
+    uint32 Event = 0;
+    while (Tick < mTickRing.Num() || Event < mEventRing.Num())
+    {
+        const bool TakeTick = Event == mEventRing.Num()
+            || (Tick < mTickRing.Num() && static_cast<int32>(mTickRing[Tick].Sequence - mEventRing[Event].Sequence) < 0);
+        const auto& Record = TakeTick ? mTickRing[Tick++] : mEventRing[Event++];
+        FString Name = GetEventName(Record.Event);
+        if (Record.Event == EAutoSplitterTraceEvent::MoreOutputs)
+        {
+            Name = FString::Printf(TEXT("  outputs %d-%d"),FirstOutput,FirstOutput + 2);
+            FirstOutput += 3;
+        }
+        else
+        {
+            FirstOutput = 3;
+        }
+
+        Out += FString::Printf(
+            TEXT("%10u %-16s %d %d %d\n"),
+            Record.Frame,
+            *Name,
+            Record.Data[0],
+            Record.Data[1],
+            Record.Data[2]
+            );
+    }
+}
@@ -1,6 +1,7 @@
 ﻿#pragma once
 
 // define to 1 to get more debug output to console when the debug flag is set in the splitter UI
+// the debug flag also selects the splitters dumped by the AutoSplitters.DumpTrace console command
 #define AUTO_SPLITTERS_DEBUG 1
 
 #include "CoreMinimal.h"
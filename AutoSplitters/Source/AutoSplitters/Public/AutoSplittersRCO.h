@@ -44,6 +44,9 @@ public:
     UFUNCTION(Server,Reliable)
     void SetOutputAutomatic(AMFGBuildableAutoSplitter* Splitter, int32 Output, bool Automatic) const;
 
+    UFUNCTION(Server,Reliable)
+    void SetTokenBucketDistribution(AMFGBuildableAutoSplitter* Splitter, bool Enabled) const;
+
     UFUNCTION(Server,Reliable)
     void BalanceNetwork(AMFGBuildableAutoSplitter* Splitter, bool RootOnly) const;
 
@@ -16,6 +16,9 @@ enum class EAutoSplittersSerializationVersion : uint8
     // moved replicated properties to nested struct
     NestedReplicationStruct,
 
+    // per-output properties are sized by the number of outputs of the splitter
+    PerOutputArrays,
+
     // keep at the bottom of the list
     VersionPlusOne,
     Latest = VersionPlusOne - 1
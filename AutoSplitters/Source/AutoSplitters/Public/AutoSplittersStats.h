@@ -0,0 +1,24 @@
+#pragma once
+
+#include "Stats/Stats.h"
+#include "Trace/Trace.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+
+DECLARE_STATS_GROUP(TEXT("AutoSplitters"),STATGROUP_AutoSplitters,STATCAT_Advanced);
+
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Factory_Tick"),STAT_AutoSplitters_FactoryTick,STATGROUP_AutoSplitters,AUTOSPLITTERS_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Factory_GrabOutput"),STAT_AutoSplitters_GrabOutput,STATGROUP_AutoSplitters,AUTOSPLITTERS_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("SetupDistribution"),STAT_AutoSplitters_SetupDistribution,STATGROUP_AutoSplitters,AUTOSPLITTERS_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("PrepareCycle"),STAT_AutoSplitters_PrepareCycle,STATGROUP_AutoSplitters,AUTOSPLITTERS_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("BalanceNetwork"),STAT_AutoSplitters_BalanceNetwork,STATGROUP_AutoSplitters,AUTOSPLITTERS_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("SolveNetwork"),STAT_AutoSplitters_SolveNetwork,STATGROUP_AutoSplitters,AUTOSPLITTERS_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("DiscoverHierarchy"),STAT_AutoSplitters_DiscoverHierarchy,STATGROUP_AutoSplitters,AUTOSPLITTERS_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Belt walk"),STAT_AutoSplitters_BeltWalk,STATGROUP_AutoSplitters,AUTOSPLITTERS_API);
+
+// Unreal Insights channel for the mod, enable with -trace=cpu,AutoSplitters
+UE_TRACE_CHANNEL_EXTERN(AutoSplittersChannel,AUTOSPLITTERS_API);
+
+// records the enclosing scope in the stats group and on the Insights channel
+#define AUTO_SPLITTERS_SCOPE(Stat) \
+    SCOPE_CYCLE_COUNTER(STAT_AutoSplitters_##Stat); \
+    TRACE_CPUPROFILER_EVENT_SCOPE_ON_CHANNEL(AutoSplitters_##Stat,AutoSplittersChannel)
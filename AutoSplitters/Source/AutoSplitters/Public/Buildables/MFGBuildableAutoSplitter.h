@@ -5,6 +5,7 @@
 #include <array>
 #include <tuple>
 
+#include "Async/Future.h"
 #include "FGPlayerController.h"
 #include "FGFactoryConnectionComponent.h"
 #include "Buildables/FGBuildableAttachmentSplitter.h"
@@ -14,6 +15,10 @@
 #include "AutoSplittersRCO.h"
 #include "AutoSplittersLog.h"
 #include "util/BitField.h"
+#include "Util/AutoSplitterTrace.h"
+#include "Distribution/AutoSplitterDistribution.h"
+#include "Distribution/AutoSplitterItemBuffer.h"
+#include "Distribution/AutoSplitterNetworkGraph.h"
 
 #include "MFGBuildableAutoSplitter.generated.h"
 
@@ -35,6 +40,8 @@ enum class EAutoSplitterPersistentFlags : uint32
     ManualInputRate        =  8,
     NeedsConnectionsFixup  =  9,
     NeedsDistributionSetup = 10,
+    // distribute with token buckets instead of cycles
+    TokenBucketDistribution = 11,
 };
 
 template<>
@@ -60,18 +67,35 @@ struct is_enum_bitfield<EAutoSplitterTransientFlags> : std::true_type{};
 
 
 
+USTRUCT(BlueprintType)
+struct AUTOSPLITTERS_API FMFGBuildableAutoSplitterOutput
+{
+    GENERATED_BODY()
+
+    UPROPERTY(SaveGame, Meta = (NoAutoJson))
+    int32 State;
+
+    UPROPERTY(SaveGame, Meta = (NoAutoJson))
+    int32 Rate;
+
+    FMFGBuildableAutoSplitterOutput();
+
+};
+
 USTRUCT(BlueprintType)
 struct AUTOSPLITTERS_API FMFGBuildableAutoSplitterReplicatedProperties
 {
     GENERATED_BODY()
 
-    static constexpr int32 NUM_OUTPUTS = 3;
+    // all splitters had three outputs before PerOutputArrays
+    static constexpr int32 LEGACY_OUTPUTS = 3;
 
     UPROPERTY(Transient)
     uint32 TransientState;
 
-    UPROPERTY(SaveGame, Meta = (NoAutoJson))
-    int32 OutputStates[NUM_OUTPUTS];
+    // only read when upgrading from NestedReplicationStruct, the name has to stay for loading those saves
+    UPROPERTY(SaveGame, NotReplicated, Meta = (NoAutoJson))
+    int32 OutputStates[LEGACY_OUTPUTS];
 
     UPROPERTY(SaveGame, Meta = (NoAutoJson))
     uint32 PersistentState;
@@ -79,8 +103,13 @@ struct AUTOSPLITTERS_API FMFGBuildableAutoSplitterReplicatedProperties
     UPROPERTY(SaveGame, Meta = (NoAutoJson))
     int32 TargetInputRate;
 
+    // only read when upgrading from NestedReplicationStruct, the name has to stay for loading those saves
+    UPROPERTY(SaveGame, NotReplicated, Meta = (NoAutoJson))
+    int32 OutputRates[LEGACY_OUTPUTS];
+
+    // one entry per output of the splitter, so narrow splitters don't save and replicate the state of the widest one
     UPROPERTY(SaveGame, Meta = (NoAutoJson))
-    int32 OutputRates[NUM_OUTPUTS];
+    TArray<FMFGBuildableAutoSplitterOutput> Outputs;
 
     UPROPERTY(Transient, BlueprintReadOnly)
     int32 LeftInCycle;
@@ -98,8 +127,60 @@ struct AUTOSPLITTERS_API FMFGBuildableAutoSplitterReplicatedProperties
 
 };
 
+// Counters of noteworthy distribution and balancing events, either for a single splitter or aggregated
+USTRUCT(BlueprintType)
+struct AUTOSPLITTERS_API FAutoSplitterStatistics
+{
+    GENERATED_BODY()
+
+    // number of splitters that contributed to these statistics
+    UPROPERTY(Transient, BlueprintReadOnly)
+    int32 Splitters;
+
+    // items charged to an output because it was blocked
+    UPROPERTY(Transient, BlueprintReadOnly)
+    int64 PenalizedItems;
+
+    // ticks in which items could not be assigned because all eligible outputs were blocked
+    UPROPERTY(Transient, BlueprintReadOnly)
+    int64 BlockedTicks;
+
+    UPROPERTY(Transient, BlueprintReadOnly)
+    int64 CycleExtensions;
+
+    UPROPERTY(Transient, BlueprintReadOnly)
+    int64 CycleShortenings;
+
+    // cycles restarted because too many items were handed out beyond the end of the cycle
+    UPROPERTY(Transient, BlueprintReadOnly)
+    int64 CycleResets;
+
+    // network balancing runs, only counted for the root splitter
+    UPROPERTY(Transient, BlueprintReadOnly)
+    int64 BalanceRuns;
+
+    UPROPERTY(Transient, BlueprintReadOnly)
+    int64 InvalidBalanceRuns;
+
+    FAutoSplitterStatistics();
+
+    FAutoSplitterStatistics& operator+=(const FAutoSplitterStatistics& Other)
+    {
+        Splitters += Other.Splitters;
+        PenalizedItems += Other.PenalizedItems;
+        BlockedTicks += Other.BlockedTicks;
+        CycleExtensions += Other.CycleExtensions;
+        CycleShortenings += Other.CycleShortenings;
+        CycleResets += Other.CycleResets;
+        BalanceRuns += Other.BalanceRuns;
+        InvalidBalanceRuns += Other.InvalidBalanceRuns;
+        return *this;
+    }
+};
+
 
 class AMFGBuildableAutoSplitter;
+class AAutoSplittersSubsystem;
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FAMFGBuildableAutoSplitterOnStateChanged,AMFGBuildableAutoSplitter*,AutoSplitter);
 
 /**
@@ -114,6 +195,7 @@ class AUTOSPLITTERS_API AMFGBuildableAutoSplitter : public AFGBuildableAttachmen
     friend class AMFGAutoSplitterHologram;
     friend class UAutoSplittersRCO;
     friend class AMFGReplicationDetailActor_BuildableAutoSplitter;
+    friend class AAutoSplittersSubsystem;
 
 public:
 
@@ -123,17 +205,15 @@ public:
 
     static constexpr uint32 VERSION = 1;
 
-    static constexpr int32 MAX_INVENTORY_SIZE = 10;
-    static constexpr float EXPONENTIAL_AVERAGE_WEIGHT = 0.5f;
-    static constexpr int32 NUM_OUTPUTS = 3;
-    static constexpr float BLOCK_DETECTION_THRESHOLD = 0.5f;
+    static constexpr int32 MAX_INVENTORY_SIZE = FAutoSplitterDistribution::MAX_INVENTORY_SIZE;
+    static constexpr int32 MAX_OUTPUTS = FAutoSplitterDistribution::MAX_OUTPUTS;
 
     static constexpr int32 FRACTIONAL_RATE_DIGITS = 3;
     static constexpr int32 FRACTIONAL_RATE_MULTIPLIER = Pow_Constexpr(10,FRACTIONAL_RATE_DIGITS);
     static constexpr float INV_FRACTIONAL_RATE_MULTIPLIER = 1.0f / FRACTIONAL_RATE_MULTIPLIER;
 
-    static constexpr int32 FRACTIONAL_SHARE_DIGITS = 5;
-    static constexpr int64 FRACTIONAL_SHARE_MULTIPLIER = Pow_Constexpr(10,FRACTIONAL_SHARE_DIGITS);
+    static constexpr int32 FRACTIONAL_SHARE_DIGITS = FAutoSplitterNetworkGraph::FRACTIONAL_SHARE_DIGITS;
+    static constexpr int64 FRACTIONAL_SHARE_MULTIPLIER = FAutoSplitterNetworkGraph::FRACTIONAL_SHARE_MULTIPLIER;
     static constexpr float INV_FRACTIONAL_SHARE_MULTIPLIER = 1.0f / FRACTIONAL_SHARE_MULTIPLIER;
 
     static constexpr float UPGRADE_POSITION_REQUIRED_DELTA = 100.0f;
@@ -144,13 +224,22 @@ public:
     virtual void GetLifetimeReplicatedProps( TArray< FLifetimeProperty >& OutLifetimeProps ) const override;
 
     virtual void BeginPlay() override;
+    virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+    virtual void PreSaveGame_Implementation(int32 saveVersion, int32 gameVersion) override;
+    virtual void PostSaveGame_Implementation(int32 saveVersion, int32 gameVersion) override;
     virtual void PostLoadGame_Implementation(int32 saveVersion, int32 gameVersion) override;
 
+    virtual void GetDismantleInventoryReturns(TArray<FInventoryStack>& out_returns) const override;
+
     virtual UClass* GetReplicationDetailActorClass() const override;
 
+    // Implementation of the AutoSplitters.DumpTrace console command
+    static void DumpTraces(const TArray<FString>& Args, UWorld* World);
+
 protected:
 
     virtual void Factory_Tick(float dt) override;
+    virtual void Factory_CollectInput_Implementation() override;
     virtual bool Factory_GrabOutput_Implementation( UFGFactoryConnectionComponent* connection, FInventoryItem& out_item, float& out_OffsetBeyond, TSubclassOf< UFGItemDescriptor > type ) override;
     virtual void FillDistributionTable(float dt) override;
 
@@ -169,6 +258,8 @@ protected:
 
     bool Server_SetOutputAutomatic(int32 Output, bool Automatic);
 
+    bool Server_SetTokenBucketDistribution(bool Enabled);
+
     void Server_ReplicationEnabledTimeout();
 
     UFUNCTION()
@@ -182,9 +273,34 @@ private:
     void SetupDistribution(bool LoadingSave = false);
     void PrepareCycle(bool AllowCycleExtension, bool Reset = false);
 
-    bool IsOutputBlocked(int32 Output) const
+    // grabbing happens for every attached conveyor in every frame, so avoid going through mOutputs
+    void CacheOutputConnections();
+
+    int32 FindOutputIndex(const UFGFactoryConnectionComponent* Connection) const
+    {
+        for (int32 i = 0 ; i < GetNumOutputs() ; ++i)
+        {
+            if (mOutputConnections[i] == Connection)
+                return i;
+        }
+        return -1;
+    }
+
+    // a sleeping splitter only pulls from its input until it has items and outputs again
+    bool ShouldWakeUp() const;
+
+    // The buffer inventory is only used to present the buffered items to the save system, and to the UI while
+    // replication is enabled
+    void SetupItemBuffer();
+    void MoveBufferInventoryToItemBuffer();
+    void CopyItemBufferToBufferInventory();
+
+    // copies the distribution state that is visible to clients and blueprints into mReplicated
+    void UpdateReplicatedDistributionState()
     {
-        return mBlockedFor[Output] > BLOCK_DETECTION_THRESHOLD;
+        mReplicated.LeftInCycle = mDistribution.LeftInCycle;
+        mReplicated.CycleLength = mDistribution.CycleLength;
+        mReplicated.ItemRate = mDistribution.ItemRate;
     }
 
 protected:
@@ -213,8 +329,12 @@ protected:
     UPROPERTY(Transient)
     int32 mLeftInCycle_DEPRECATED;
 
+    // only read when upgrading from NestedReplicationStruct, the name has to stay for loading those saves
+    UPROPERTY(SaveGame, Meta = (NoAutoJson))
+    int32 mLeftInCycleForOutputs[FMFGBuildableAutoSplitterReplicatedProperties::LEGACY_OUTPUTS];
+
     UPROPERTY(SaveGame, Meta = (NoAutoJson))
-    int32 mLeftInCycleForOutputs[NUM_OUTPUTS];
+    TArray<int32> mOutputsLeftInCycle;
 
     UPROPERTY(Transient, BlueprintReadWrite)
     bool mDebug;
@@ -233,19 +353,25 @@ protected:
 
 private:
 
-    std::array<int32,NUM_OUTPUTS> mItemsPerCycle;
-    std::array<float,NUM_OUTPUTS> mBlockedFor;
-    std::array<int32,NUM_OUTPUTS> mAssignedItems;
-    std::array<int32,NUM_OUTPUTS> mGrabbedItems;
-    std::array<float,NUM_OUTPUTS> mPriorityStepSize;
-    std::array<int32,MAX_INVENTORY_SIZE> mAssignedOutputs;
-    std::array<int32,NUM_OUTPUTS> mNextInventorySlot;
-    std::array<int32,NUM_OUTPUTS> mInventorySlotEnd;
+    // the actual distribution state, mOutputsLeftInCycle only mirrors it for the save game
+    FAutoSplitterDistribution mDistribution;
+
+    std::array<UFGFactoryConnectionComponent*,MAX_OUTPUTS> mOutputConnections;
+
+    // Buffered items, replaces mBufferInventory while the splitter is running. The inventory only holds the items while
+    // saving, the UI shows their number from GetInventorySize().
+    TAutoSplitterItemBuffer<FInventoryItem,MAX_INVENTORY_SIZE> mItemBuffer;
+
+    // recent distribution and balancing events, only formatted when dumped
+    FAutoSplitterTrace mTrace;
+
+    FAutoSplitterStatistics mStatistics;
 
     bool mBalancingRequired;
+    // waiting in the balancing queue of the subsystem
+    bool mBalancingQueued;
     bool mNeedsInitialDistributionSetup;
-    float mCycleTime;
-    int32 mReallyGrabbed;
+    bool mIsSleeping;
 
     FTimerHandle mReplicationTimer;
 
@@ -257,6 +383,13 @@ public:
         return FRACTIONAL_RATE_DIGITS;
     }
 
+    // the number of outputs is defined by the output connections of the buildable, but capped at MAX_OUTPUTS
+    UFUNCTION(BlueprintPure)
+    int32 GetNumOutputs() const
+    {
+        return FMath::Min(mOutputs.Num(),MAX_OUTPUTS);
+    }
+
     UFUNCTION(BlueprintPure)
     bool IsReplicationEnabled() const
     {
@@ -270,7 +403,7 @@ public:
             Server_EnableReplication(Duration);
         else
         {
-            UE_LOG(LogAutoSplitters,Display,TEXT("Forwarding AMFGBuildableAutoSplitter::EnableReplication() to RCO"));
+            UE_LOG(LogAutoSplitters,Verbose,TEXT("Forwarding AMFGBuildableAutoSplitter::EnableReplication() to RCO"));
             RCO()->EnableReplication(this,Duration);
         }
     }
@@ -288,7 +421,7 @@ public:
             Server_SetTargetRateAutomatic(Automatic);
         else
         {
-            UE_LOG(LogAutoSplitters,Display,TEXT("Forwarding AMFGBuildableAutoSplitter::SetTargetRateAutomatic() to RCO"));
+            UE_LOG(LogAutoSplitters,Verbose,TEXT("Forwarding AMFGBuildableAutoSplitter::SetTargetRateAutomatic() to RCO"));
             RCO()->SetTargetRateAutomatic(this,Automatic);
         }
     }
@@ -304,7 +437,7 @@ public:
             Server_SetTargetInputRate(Rate);
         else
         {
-            UE_LOG(LogAutoSplitters,Display,TEXT("Forwarding AMFGBuildableAutoSplitter::SetTargetInputRate() to RCO"));
+            UE_LOG(LogAutoSplitters,Verbose,TEXT("Forwarding AMFGBuildableAutoSplitter::SetTargetInputRate() to RCO"));
             RCO()->SetTargetInputRate(this,Rate);
         }
     }
@@ -319,7 +452,7 @@ public:
             Server_SetOutputRate(Output,Rate);
         else
         {
-            UE_LOG(LogAutoSplitters,Display,TEXT("Forwarding AMFGBuildableAutoSplitter::SetOutputRate() to RCO"));
+            UE_LOG(LogAutoSplitters,Verbose,TEXT("Forwarding AMFGBuildableAutoSplitter::SetOutputRate() to RCO"));
             RCO()->SetOutputRate(this,Output,Rate);
         }
     }
@@ -331,7 +464,7 @@ public:
             Server_SetOutputAutomatic(Output,Automatic);
         else
         {
-            UE_LOG(LogAutoSplitters,Display,TEXT("Forwarding AMFGBuildableAutoSplitter::OutputAutomatic() to RCO"));
+            UE_LOG(LogAutoSplitters,Verbose,TEXT("Forwarding AMFGBuildableAutoSplitter::OutputAutomatic() to RCO"));
             RCO()->SetOutputAutomatic(this,Output,Automatic);
         }
     }
@@ -339,28 +472,47 @@ public:
     UFUNCTION(BlueprintPure)
     bool IsOutputAutomatic(int32 Output) const
     {
-        if (Output < 0 || Output > NUM_OUTPUTS)
+        // clients only know the outputs once the first replication arrived
+        if (!mReplicated.Outputs.IsValidIndex(Output))
             return false;
 
-        return IsSet(mReplicated.OutputStates[Output],EOutputState::Automatic);
+        return IsSet(mReplicated.Outputs[Output].State,EOutputState::Automatic);
     }
 
     UFUNCTION(BlueprintPure)
     bool IsOutputAutoSplitter(int32 Output) const
     {
-        if (Output < 0 || Output > NUM_OUTPUTS)
+        if (!mReplicated.Outputs.IsValidIndex(Output))
             return false;
 
-        return IsSet(mReplicated.OutputStates[Output],EOutputState::AutoSplitter);
+        return IsSet(mReplicated.Outputs[Output].State,EOutputState::AutoSplitter);
     }
 
     UFUNCTION(BlueprintPure)
     bool IsOutputConnected(int32 Output) const
     {
-        if (Output < 0 || Output > NUM_OUTPUTS)
+        if (!mReplicated.Outputs.IsValidIndex(Output))
             return false;
 
-        return IsSet(mReplicated.OutputStates[Output],EOutputState::Connected);
+        return IsSet(mReplicated.Outputs[Output].State,EOutputState::Connected);
+    }
+
+    UFUNCTION(BlueprintPure)
+    bool IsTokenBucketDistribution() const
+    {
+        return IsSplitterFlagSet(EPersistent::TokenBucketDistribution);
+    }
+
+    UFUNCTION(BlueprintCallable)
+    void SetTokenBucketDistribution(bool Enabled)
+    {
+        if (HasAuthority())
+            Server_SetTokenBucketDistribution(Enabled);
+        else
+        {
+            UE_LOG(LogAutoSplitters,Verbose,TEXT("Forwarding AMFGBuildableAutoSplitter::SetTokenBucketDistribution() to RCO"));
+            RCO()->SetTokenBucketDistribution(this,Enabled);
+        }
     }
 
     UFUNCTION(BlueprintCallable)
@@ -370,7 +522,7 @@ public:
             Server_BalanceNetwork(this,RootOnly);
         else
         {
-            UE_LOG(LogAutoSplitters,Display,TEXT("Forwarding AMFGBuildableAutoSplitter::BalanceNetwork() to RCO"));
+            UE_LOG(LogAutoSplitters,Verbose,TEXT("Forwarding AMFGBuildableAutoSplitter::BalanceNetwork() to RCO"));
             RCO()->BalanceNetwork(this,RootOnly);
         }
     }
@@ -392,6 +544,13 @@ public:
         return mReplicated.ItemRate;
     }
 
+    // only available on the server
+    UFUNCTION(BlueprintPure)
+    FAutoSplitterStatistics GetStatistics() const
+    {
+        return mStatistics;
+    }
+
     UFUNCTION(BluePrintPure)
     static bool IsDebugSupported()
     {
@@ -414,37 +573,157 @@ public:
         return mReplicated.TransientState & 0xFFu;
     }
 
-    struct FNetworkNode
-    {
-        AMFGBuildableAutoSplitter* Splitter;
-        FNetworkNode* Input;
-        int32 MaxInputRate;
-        std::array<FNetworkNode*,NUM_OUTPUTS> Outputs;
-        std::array<int64,NUM_OUTPUTS> PotentialShares;
-        std::array<int32,NUM_OUTPUTS> MaxOutputRates;
-        int32 FixedDemand;
-        int64 Shares;
-        int32 AllocatedInputRate;
-        std::array<int32,NUM_OUTPUTS> AllocatedOutputRates;
-        bool ConnectionStateChanged;
-
-        explicit FNetworkNode(AMFGBuildableAutoSplitter* Splitter, FNetworkNode* Input = nullptr)
-            : Splitter(Splitter)
-            , Input(Input)
-            , MaxInputRate(0)
-            , Outputs({nullptr})
-            , PotentialShares({0})
-            , MaxOutputRates({0})
-            , FixedDemand(0)
-            , Shares(0)
-            , AllocatedInputRate(0)
-            , AllocatedOutputRates({0})
-            , ConnectionStateChanged(false)
+    using FNetworkGraph = FAutoSplitterNetworkGraph;
+    static constexpr int32 NO_NODE = FNetworkGraph::NO_NODE;
+
+    // copy of a network graph that is solved on a worker thread
+    struct FBalancingSolve
+    {
+        FNetworkGraph Graph;
+        FNetworkGraph::EAllocationResult Result = FNetworkGraph::EAllocationResult::Ready;
+        int32 FailedNode = NO_NODE;
+    };
+
+    // topology and balancing results of a network, cached by AAutoSplittersSubsystem
+    struct FNetwork
+    {
+        FNetworkGraph Graph;
+
+        // splitter of each node and the factories at the end of its outputs that are not connected to a splitter
+        TArray<AMFGBuildableAutoSplitter*> Splitters;
+        TArray<std::array<AFGBuildableFactory*,MAX_OUTPUTS>> Factories;
+
+        // topology generation of the subsystem at discovery time
+        uint32 Generation;
+
+        // bumped by every balancing run, so a run that is spread over several frames notices when another run
+        // has touched the network in the meantime
+        uint32 Revision;
+
+        // the node results match the current splitter settings, so the network can be rebalanced incrementally
+        bool Balanced;
+
+        // Kept across runs, so the graph copy for the worker thread reuses its storage. Also survives Reset(), spare
+        // networks hand it on to the next network.
+        TSharedPtr<FBalancingSolve,ESPMode::ThreadSafe> Solve;
+
+        FNetwork()
+            : Generation(0)
+            , Revision(0)
+            , Balanced(false)
+        {}
+
+        int32 Num() const
+        {
+            return Graph.Num();
+        }
+
+        int32 AddNode(AMFGBuildableAutoSplitter* Splitter, int32 InputNode, int32 ChildInParent)
+        {
+            Splitters.Add(Splitter);
+            Factories.AddZeroed();
+            return Graph.AddNode(InputNode,ChildInParent);
+        }
+
+        // removes all nodes, but keeps the storage for the next network
+        void Reset()
+        {
+            Graph.Reset();
+            Splitters.Reset();
+            Factories.Reset();
+            Generation = 0;
+            Revision = 0;
+            Balanced = false;
+        }
+    };
+
+    // A full balancing run that can be suspended between nodes, so the subsystem can spread huge networks over
+    // several frames. The splitters keep their current settings until the whole network has been solved.
+    struct FBalancingJob
+    {
+        enum class EPhase : uint8
+        {
+            Discover,
+            // copying the splitter settings into the graph
+            Snapshot,
+            // waiting for the worker thread
+            Solve,
+            Apply,
+            // the new settings have been applied
+            Done,
+            // the network could not be balanced
+            Failed,
+            // the topology or the network changed while the job was suspended, the run has to start over
+            Stale,
+        };
+
+        struct FPendingSplitter
+        {
+            AMFGBuildableAutoSplitter* Splitter;
+            int32 InputNode;
+            int32 ChildInParent;
+        };
+
+        TWeakObjectPtr<AMFGBuildableAutoSplitter> Root;
+        AAutoSplittersSubsystem* Subsystem;
+        EPhase Phase;
+
+        // the network is only handed over to the subsystem once discovery is complete
+        TUniquePtr<FNetwork> Discovered;
+        FNetwork* Network;
+
+        // splitters still to be discovered and the next node for the other phases
+        TArray<FPendingSplitter> Pending;
+        int32 Cursor;
+
+        bool ExtractPotentialShares;
+
+        // Cached networks still have the potential shares from their discovery, but the machines at the end of the
+        // outputs might have been overclocked since. The snapshot phase refreshes them node by node.
+        bool RefreshPotentialShares;
+
+        // solve on a worker thread and apply the results on a later tick
+        bool SolveAsync;
+        TSharedPtr<FBalancingSolve,ESPMode::ThreadSafe> Solve;
+        TFuture<void> SolveDone;
+
+        FNetworkGraph::EAllocationResult Result;
+        int32 FailedNode;
+
+        // topology generation and network revision the job is working on
+        uint32 Generation;
+        uint32 Revision;
+
+        FBalancingJob()
+            : Subsystem(nullptr)
+            , Phase(EPhase::Failed)
+            , Network(nullptr)
+            , Cursor(0)
+            , ExtractPotentialShares(false)
+            , RefreshPotentialShares(false)
+            , SolveAsync(false)
+            , Result(FNetworkGraph::EAllocationResult::Ready)
+            , FailedNode(NO_NODE)
+            , Generation(0)
+            , Revision(0)
         {}
+
+        bool IsFinished() const
+        {
+            return Phase >= EPhase::Done;
+        }
     };
 
 private:
 
+    // cached network this splitter belongs to and its node in there, only valid for mNetworkGeneration
+    FNetwork* mNetwork;
+    int32 mNetworkNode;
+    uint32 mNetworkGeneration;
+
+    // returns the node of this splitter in the cached network, or NO_NODE if the topology has changed since
+    int32 GetNetworkNode() const;
+
     void SetError(uint8 Error)
     {
         mReplicated.TransientState = (mReplicated.TransientState & ~0xFFu) | static_cast<uint32>(Error);
@@ -458,25 +737,90 @@ private:
     void FixupConnections();
     void SetupInitialDistributionState();
 
+    // checks that have to run on every factory tick, returns false if there is no distribution work to do
+    bool PrepareTick(float dt);
+
+    // assigns the buffered items to the outputs
+    void TickDistribution(float dt);
+
     static std::tuple<bool,int32> Server_BalanceNetwork(AMFGBuildableAutoSplitter* ForSplitter, bool RootOnly = false);
 
+    // Finds the network of ForSplitter and prepares Job for a full run, returns false if it cannot be balanced now
+    static bool BeginBalancing(FBalancingJob& Job, AMFGBuildableAutoSplitter* ForSplitter, bool RootOnly);
+
+    // Works on Job until it is finished, reaches StopAt or FPlatformTime::Seconds() passes Deadline, a Deadline of 0
+    // runs it to completion. Returns true once the job is finished. Past discovery, jobs for different networks may
+    // be continued concurrently.
+    static bool ContinueBalancing(
+        FBalancingJob& Job,
+        double Deadline,
+        FBalancingJob::EPhase StopAt = FBalancingJob::EPhase::Done
+        );
+
+    // Rebalances the network after a change to the settings of ForSplitter or its outputs. Only the path to the root
+    // and the subtrees whose input rate changes are recalculated, falls back to a full run without a cached network.
+    static std::tuple<bool,int32> Server_RebalanceNetwork(AMFGBuildableAutoSplitter* ForSplitter);
+
+    // copies the settings of the node's splitter into the graph and updates the output states of the node
+    static void SnapshotNode(FNetwork& Network, int32 Node);
+
+    // logs why the node could not be allocated and records it in the trace of its splitter
+    static void ReportAllocationFailure(FNetwork& Network, int32 Node, FNetworkGraph::EAllocationResult Result);
+
+    // copies the output states and allocated rates into the node's splitter
+    static void ApplyNode(FNetwork& Network, int32 Node);
+
+    // reads the pending potential of a factory at the end of an output
+    static int64 GetPotentialShares(AFGBuildableFactory* Factory, bool ExtractPotentialShares);
+
     static std::tuple<AMFGBuildableAutoSplitter*, int32, bool>
     FindAutoSplitterAndMaxBeltRate(UFGFactoryConnectionComponent* Connection, bool Forward);
 
     static std::tuple<AFGBuildableFactory*, int32, bool>
     FindFactoryAndMaxBeltRate(UFGFactoryConnectionComponent* Connection, bool Forward);
 
-    static bool DiscoverHierarchy(
-        TArray<TArray<FNetworkNode>>& Nodes,
-        AMFGBuildableAutoSplitter* Splitter,
-        const int32 Level,
-        FNetworkNode* InputNode,
-        const int32 ChildInParent,
-        AMFGBuildableAutoSplitter* Root, bool ExtractPotentialShares
-    );
+    // adds the next pending splitter of Job to its network, fails if the splitter has not begun play yet
+    static bool DiscoverNextSplitter(FBalancingJob& Job);
+
+    // claims Network for Job and starts aggregating its nodes
+    static void BeginSolve(FBalancingJob& Job, FNetwork& Network);
 
     void SetSplitterVersion(uint32 Version);
 
+    // appends the current distribution state and the recorded trace events to Out
+    void FormatTrace(FString& Out) const;
+
+    // sizes the saved and replicated per-output properties to the outputs of this splitter
+    void SizeOutputArrays();
+
+    // copies one property of every output into the fixed-size layout of the distribution and the balancing graph
+    std::array<int32,MAX_OUTPUTS> GatherOutputs(int32 FMFGBuildableAutoSplitterOutput::* Property) const
+    {
+        std::array<int32,MAX_OUTPUTS> Result = {};
+        for (int32 i = 0 ; i < mReplicated.Outputs.Num() ; ++i)
+            Result[i] = mReplicated.Outputs[i].*Property;
+        return Result;
+    }
+
+    // joins the values of all outputs of this splitter for logs and traces
+    template <typename ValuesType>
+    FString FormatOutputs(const ValuesType& Values) const
+    {
+        FString Result;
+        for (int32 i = 0 ; i < GetNumOutputs() ; ++i)
+        {
+            if (i > 0)
+                Result += TEXT(" ");
+            Result.AppendInt(Values[i]);
+        }
+        return Result;
+    }
+
+    static AMFGBuildableAutoSplitter* FindNetworkRoot(AMFGBuildableAutoSplitter* Splitter);
+
+    // finds the root of the network containing Splitter and collects all splitters of that network
+    static void CollectNetwork(AMFGBuildableAutoSplitter* Splitter, TSet<AMFGBuildableAutoSplitter*>& out_Splitters);
+
     FORCEINLINE bool IsSplitterFlagSet(EPersistent Flag) const
     {
         return IsSet(mReplicated.PersistentState,Flag);
@@ -0,0 +1,19 @@
+// ILikeBanas
+
+#pragma once
+
+#include "Buildables/MFGBuildableAutoSplitter.h"
+
+#include "MFGBuildableWideAutoSplitter.generated.h"
+
+/**
+ * Auto Splitter with more than three outputs, so a whole row of machines can be fed from a single splitter instead of
+ * a tree of them. The outputs are defined by the connection components of the blueprint, up to MAX_OUTPUTS of them are
+ * used. Distribution and balancing treat it like any other Auto Splitter, it only gets its own class to keep it apart
+ * from the standard splitter, e.g. when rebuilding splitters from old save games.
+ */
+UCLASS()
+class AUTOSPLITTERS_API AMFGBuildableWideAutoSplitter : public AMFGBuildableAutoSplitter
+{
+    GENERATED_BODY()
+};
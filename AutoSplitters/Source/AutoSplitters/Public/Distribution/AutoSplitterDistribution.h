@@ -0,0 +1,206 @@
+// ILikeBanas
+
+#pragma once
+
+// This is the engine-independent core of the Auto Splitter item distribution. It must not depend on any Unreal or
+// FactoryGame headers, so it can also be built and profiled outside of the game.
+
+#include <array>
+#include <cstdint>
+
+struct FAutoSplitterDistribution
+{
+    // the state is sized for the widest splitter, narrower splitters never activate the outputs they do not have
+    static constexpr std::int32_t MAX_OUTPUTS = 8;
+    static constexpr std::uint32_t ALL_OUTPUTS = (1u << MAX_OUTPUTS) - 1;
+    static constexpr std::int32_t MAX_INVENTORY_SIZE = 10;
+    static constexpr float EXPONENTIAL_AVERAGE_WEIGHT = 0.5f;
+    static constexpr float BLOCK_DETECTION_THRESHOLD = 0.5f;
+
+    // cycles that have been overrun by more than this many items are restarted from scratch
+    static constexpr std::int32_t CYCLE_RESET_THRESHOLD = -40;
+
+    // cycle time window outside of which the cycle length gets adapted
+    static constexpr float MIN_CYCLE_TIME = 2.0f;
+    static constexpr float MAX_CYCLE_TIME = 10.0f;
+
+    // longest cycle for which the emission order gets precomputed
+    static constexpr std::int32_t MAX_SCHEDULE_LENGTH = 128;
+
+    // return value of GrabItem()
+    static constexpr std::int32_t NO_ASSIGNED_ITEM = -1;
+
+    enum class ESetupResult : std::uint8_t
+    {
+        NothingConnected,
+        NothingToDistribute,
+        Ready,
+    };
+
+    enum class ECycleAdjustment : std::uint8_t
+    {
+        None,
+        Extended,
+        Shortened,
+    };
+
+    enum class EMode : std::uint8_t
+    {
+        // hand out ItemsPerCycle to the outputs in cycles of CycleLength items
+        Cycles,
+        // Every handed out item refills the buckets of the outputs that could have taken it in proportion to their
+        // rates and costs the sum of those rates. There are no cycles, so the cycle state stays empty.
+        TokenBuckets,
+    };
+
+    std::array<std::int32_t,MAX_OUTPUTS> ItemsPerCycle;
+    std::array<std::int32_t,MAX_OUTPUTS> LeftInCycleForOutputs;
+    std::array<float,MAX_OUTPUTS> BlockedFor;
+    std::array<std::int32_t,MAX_OUTPUTS> AssignedItems;
+    std::array<std::int32_t,MAX_OUTPUTS> GrabbedItems;
+    std::array<float,MAX_OUTPUTS> PriorityStepSize;
+
+    // per-output FIFO of assigned buffer slots, outputs may pop entries from ReadyHead up to ReadyCount
+    std::array<std::array<std::uint8_t,MAX_INVENTORY_SIZE>,MAX_OUTPUTS> ReadyQueue;
+    std::array<std::int32_t,MAX_OUTPUTS> ReadyHead;
+    std::array<std::int32_t,MAX_OUTPUTS> ReadyCount;
+
+    // schedule steps taken before each queued item was assigned, the entry behind the last item holds all steps
+    std::array<std::array<std::uint8_t,MAX_INVENTORY_SIZE + 1>,MAX_OUTPUTS> ReadySteps;
+
+    // items handed out since the last call to CommitGrabs(), booked against the cycle in one go
+    std::array<std::int32_t,MAX_OUTPUTS> HandedOutItems;
+
+    // bit mask of outputs that are connected and have a non-zero rate
+    std::uint32_t ActiveOutputs;
+
+    // picked up by the next call to Setup()
+    EMode Mode;
+
+    // token bucket mode: rates of the active outputs and the tokens of each output in the same fixed point unit
+    std::array<std::int32_t,MAX_OUTPUTS> TokenRates;
+    std::array<std::int64_t,MAX_OUTPUTS> Tokens;
+
+    // AssignItems() specialized for ActiveOutputs, selected by Setup()
+    using FAssignKernel = std::int32_t (FAutoSplitterDistribution::*)(const std::int32_t*, std::int32_t, float);
+    FAssignKernel AssignKernel;
+
+    // Precomputed interleaved emission order for one base cycle, empty if the cycle is too long. The cursor only
+    // moves past items that have actually been handed out, AssignItems() follows the schedule on a copy.
+    std::array<std::uint8_t,MAX_SCHEDULE_LENGTH> Schedule;
+    std::int32_t ScheduleLength;
+    std::int32_t ScheduleCursor;
+
+    std::int32_t LeftInCycle;
+    std::int32_t CycleLength;
+    std::int32_t ReallyGrabbed;
+
+    // items charged to blocked outputs during the last call to AssignItems()
+    std::int32_t PenalizedItems;
+    float CycleTime;
+    float ItemRate;
+
+    FAutoSplitterDistribution();
+
+    bool IsOutputBlocked(std::int32_t Output) const
+    {
+        return BlockedFor[Output] > BLOCK_DETECTION_THRESHOLD;
+    }
+
+    bool IsOutputActive(std::int32_t Output) const
+    {
+        return ActiveOutputs & (1u << Output);
+    }
+
+    bool NeedsCycleReset() const
+    {
+        return LeftInCycle < CYCLE_RESET_THRESHOLD;
+    }
+
+    bool UsesTokenBuckets() const
+    {
+        return Mode == EMode::TokenBuckets;
+    }
+
+    // Recalculates the per-cycle item counts or the token rates from the connection mask and the configured output rates
+    ESetupResult Setup(std::uint32_t ConnectedOutputs, const std::int32_t* OutputRates, bool LoadingSave);
+
+    // Updates the item rate and starts the next cycle. In token bucket mode, this only updates the item rate.
+    ECycleAdjustment PrepareCycle(bool AllowCycleExtension, bool Reset);
+
+    // Builds a smooth weighted round-robin order from ItemsPerCycle
+    void BuildSchedule();
+
+    // Carries the progress of each output through the current cycle over to the new ItemsPerCycle, so a rate change
+    // does not restart the cycle. Credit and deficit are capped at one cycle.
+    void RescaleCycle(const std::array<std::int32_t,MAX_OUTPUTS>& OldItemsPerCycle, std::int32_t OldCycleLength);
+
+    // Returns the output with the most assignable items relative to its step size, skipping outputs without
+    // assignable items and those in the Excluded mask. Ties go to the lowest output, -1 if none is eligible.
+    std::int32_t SelectOutput(const std::array<std::int32_t,MAX_OUTPUTS>& AssignableItems, std::uint32_t Excluded) const;
+
+    // SelectOutput() without SSE2, used where it is not available and as the reference for the vectorized version
+    std::int32_t SelectOutputScalar(const std::array<std::int32_t,MAX_OUTPUTS>& AssignableItems, std::uint32_t Excluded) const;
+
+    // Keeps outputs from pulling until the next call to AssignItems(), BeginTick() still sees what they grabbed
+    void LockOutputs()
+    {
+        ReadyCount = ReadyHead;
+    }
+
+    // Books the items grabbed since the last tick, advances the schedule past them and clears all assignments,
+    // includes CommitGrabs()
+    void BeginTick();
+
+    // Assigns the items in the given buffer slots (in arrival order) to outputs and makes them available for grabbing.
+    // Returns the number of items that could not be assigned because all eligible outputs were blocked.
+    std::int32_t AssignItems(const std::int32_t* PopulatedSlots, std::int32_t SlotCount, float dt)
+    {
+        return (this->*AssignKernel)(PopulatedSlots,SlotCount,dt);
+    }
+
+    // Implementations of AssignItems() and SelectOutput() that only consider the outputs in the Outputs mask. The .cpp
+    // instantiates one for every mask of the first three outputs, wider masks use the one for ALL_OUTPUTS. Masks with
+    // three or more outputs select with SSE2 where available, smaller ones unroll the scalar selection.
+    template <std::uint32_t Outputs>
+    std::int32_t AssignItemsFor(const std::int32_t* PopulatedSlots, std::int32_t SlotCount, float dt);
+
+    template <std::uint32_t Outputs>
+    std::int32_t SelectOutputFor(const std::array<std::int32_t,MAX_OUTPUTS>& AssignableItems, std::uint32_t Excluded) const;
+
+    // AssignItems() for token bucket mode, assigns every item to the unblocked output with the most tokens
+    std::int32_t AssignTokens(const std::int32_t* PopulatedSlots, std::int32_t SlotCount, float dt);
+
+    // Books the items handed out since the last call against the current cycle
+    void CommitGrabs()
+    {
+        if (Mode == EMode::TokenBuckets)
+        {
+            CommitTokens();
+            return;
+        }
+
+        for (std::int32_t i = 0 ; i < MAX_OUTPUTS ; ++i)
+        {
+            LeftInCycleForOutputs[i] -= HandedOutItems[i];
+            ReallyGrabbed += HandedOutItems[i];
+            HandedOutItems[i] = 0;
+        }
+    }
+
+    // Charges the items handed out since the last call to the token buckets
+    void CommitTokens();
+
+    // Returns the buffer slot of the next item assigned to Output or NO_ASSIGNED_ITEM
+    std::int32_t GrabItem(std::int32_t Output)
+    {
+        BlockedFor[Output] = 0.0f;
+
+        if (ReadyHead[Output] >= ReadyCount[Output])
+            return NO_ASSIGNED_ITEM;
+
+        ++GrabbedItems[Output];
+        ++HandedOutItems[Output];
+        return ReadyQueue[Output][ReadyHead[Output]++];
+    }
+};
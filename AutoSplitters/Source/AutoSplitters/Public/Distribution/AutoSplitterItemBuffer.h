@@ -0,0 +1,141 @@
+// ILikeBanas
+
+#pragma once
+
+// Fixed-capacity item store of the Auto Splitter. Like the distribution kernel, this must not depend on any Unreal or
+// FactoryGame headers.
+//
+// New items go into any free slot and can be taken out of any slot, so the buffer accepts items as long as it has room,
+// no matter which ones the outputs have grabbed. Slots never move while their item is in the buffer, the arrival order
+// is tracked separately.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <utility>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+template<typename T, std::int32_t Capacity>
+class TAutoSplitterItemBuffer
+{
+    static_assert(Capacity > 0 && Capacity <= 32,"occupancy mask only supports up to 32 slots");
+
+public:
+
+    TAutoSplitterItemBuffer()
+        : mOccupied(0)
+        , mCount(0)
+        , mSize(Capacity)
+    {}
+
+    // Restricts the buffer to the first Size slots, must only be called while the buffer is empty
+    void SetSize(std::int32_t Size)
+    {
+        mSize = Size < Capacity ? (Size > 0 ? Size : 1) : Capacity;
+    }
+
+    std::int32_t Num() const
+    {
+        return mCount;
+    }
+
+    bool IsEmpty() const
+    {
+        return mCount == 0;
+    }
+
+    bool IsFull() const
+    {
+        return mCount >= mSize;
+    }
+
+    std::uint32_t GetOccupancyMask() const
+    {
+        return mOccupied;
+    }
+
+    // Returns the slot of the new item, the caller must make sure that the buffer is not full
+    std::int32_t Push(T Item)
+    {
+        const auto Slot = CountTrailingZeros(~mOccupied);
+        mItems[Slot] = std::move(Item);
+        mOccupied |= 1u << Slot;
+        mOrder[mCount++] = static_cast<std::uint8_t>(Slot);
+        return Slot;
+    }
+
+    bool IsOccupied(std::int32_t Slot) const
+    {
+        return mOccupied & (1u << Slot);
+    }
+
+    T& operator[](std::int32_t Slot)
+    {
+        return mItems[Slot];
+    }
+
+    const T& operator[](std::int32_t Slot) const
+    {
+        return mItems[Slot];
+    }
+
+    T Take(std::int32_t Slot)
+    {
+        mOccupied &= ~(1u << Slot);
+        const auto End = mOrder.begin() + mCount;
+        const auto Position = std::find(mOrder.begin(),End,Slot);
+        std::copy(Position + 1,End,Position);
+        --mCount;
+        return std::move(mItems[Slot]);
+    }
+
+    // Writes the slots of all items into OutSlots in arrival order and returns their number. Slots stay valid until
+    // their item is taken.
+    std::int32_t GetOccupiedSlots(std::int32_t* OutSlots) const
+    {
+        std::copy(mOrder.begin(),mOrder.begin() + mCount,OutSlots);
+        return mCount;
+    }
+
+    // Calls F for every item in arrival order
+    template<typename Func>
+    void ForEach(Func&& F) const
+    {
+        for (std::int32_t i = 0 ; i < mCount ; ++i)
+            F(mItems[mOrder[i]]);
+    }
+
+    void Empty()
+    {
+        for (std::int32_t Slot = 0 ; Slot < mSize ; ++Slot)
+        {
+            if (IsOccupied(Slot))
+                mItems[Slot] = T();
+        }
+        mOccupied = 0;
+        mCount = 0;
+    }
+
+private:
+
+    static std::int32_t CountTrailingZeros(std::uint32_t Value)
+    {
+#if defined(_MSC_VER)
+        unsigned long Index;
+        _BitScanForward(&Index,Value);
+        return static_cast<std::int32_t>(Index);
+#else
+        return __builtin_ctz(Value);
+#endif
+    }
+
+    std::array<T,Capacity> mItems;
+    // slots of the items in arrival order
+    std::array<std::uint8_t,Capacity> mOrder;
+    std::uint32_t mOccupied;
+    std::int32_t mCount;
+    std::int32_t mSize;
+};
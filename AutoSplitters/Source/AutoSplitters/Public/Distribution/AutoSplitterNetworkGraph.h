@@ -0,0 +1,97 @@
+// ILikeBanas
+
+#pragma once
+
+// Flat storage for the splitter networks balanced by AMFGBuildableAutoSplitter. Nodes are addressed by index and every
+// per-node value lives in its own array, so a network can be rediscovered without any allocations once the arrays
+// have grown to its size. Like the distribution, this must not depend on any Unreal or FactoryGame headers. Once the
+// splitter settings have been copied in, a graph can be solved on any thread.
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "Distribution/AutoSplitterDistribution.h"
+
+struct FAutoSplitterNetworkGraph
+{
+    static constexpr std::int32_t MAX_OUTPUTS = FAutoSplitterDistribution::MAX_OUTPUTS;
+
+    // marks missing inputs and outputs
+    static constexpr std::int32_t NO_NODE = -1;
+
+    // shares are fixed point numbers with this many decimal digits
+    static constexpr std::int32_t FRACTIONAL_SHARE_DIGITS = 5;
+    static constexpr std::int64_t FRACTIONAL_SHARE_MULTIPLIER = 100000;
+
+    enum class EAllocationResult : std::uint8_t
+    {
+        Ready,
+        // the fixed demand below the node exceeds the max rate of its input belt
+        ExceedsMaxInputRate,
+        // the fixed demand below the node exceeds its allocated input rate
+        ExceedsInputRate,
+    };
+
+    using FOutputNodes = std::array<std::int32_t,MAX_OUTPUTS>;
+    using FOutputRates = std::array<std::int32_t,MAX_OUTPUTS>;
+    using FOutputShares = std::array<std::int64_t,MAX_OUTPUTS>;
+    using FOutputStates = std::array<std::int32_t,MAX_OUTPUTS>;
+
+    // topology, node 0 is the root and every node is stored after its input node
+    std::vector<std::int32_t> Input;
+    std::vector<FOutputNodes> Outputs;
+    std::vector<std::int32_t> MaxInputRate;
+    std::vector<FOutputRates> MaxOutputRates;
+    std::vector<FOutputShares> PotentialShares;
+
+    // splitter settings, copied in on the game thread before solving
+    std::vector<std::uint8_t> ManualInputRate;
+    std::vector<std::int32_t> TargetInputRate;
+    std::vector<FOutputRates> OutputRates;
+    std::vector<std::uint8_t> AutomaticOutputs;
+    static_assert(MAX_OUTPUTS <= 8,"AutomaticOutputs only has room for eight outputs");
+
+    // results of the last solve, the output states are only copied to the splitter when the whole network is done
+    std::vector<FOutputStates> OutputStates;
+    std::vector<std::int32_t> FixedDemand;
+    std::vector<std::int64_t> Shares;
+    std::vector<std::int32_t> AllocatedInputRate;
+    std::vector<FOutputRates> AllocatedOutputRates;
+    // difference between the allocated and the exact rate of the outputs with shares, in 1/FRACTIONAL_SHARE_MULTIPLIER
+    std::vector<FOutputShares> RateRounding;
+    std::vector<std::uint8_t> ConnectionStateChanged;
+
+    std::int32_t Num() const
+    {
+        return static_cast<std::int32_t>(Input.size());
+    }
+
+    // Removes all nodes, but keeps the storage for the next network
+    void Reset();
+
+    void Reserve(std::int32_t Nodes);
+
+    // Appends a node fed by output ChildInParent of InputNode, or a root for NO_NODE, and returns its index. The
+    // max input rate of the new node is taken from that output.
+    std::int32_t AddNode(std::int32_t InputNode, std::int32_t ChildInParent);
+
+    bool IsOutputAutomatic(const std::int32_t Node, const std::int32_t Output) const
+    {
+        return (AutomaticOutputs[Node] & (1u << Output)) != 0;
+    }
+
+    // Sums up the fixed demand and the shares of the subtree below Node, the outputs must already be aggregated
+    void AggregateNode(std::int32_t Node);
+
+    // Distributes the allocated input rate of Node among its outputs and passes it on to the child nodes
+    EAllocationResult AllocateNode(std::int32_t Node);
+
+    // Adds the share of Available of every output to its allocated rate. The rates add up to exactly Available, each
+    // one is its exact quota rounded up or down, and the rounding yields the shortest distribution cycle for Node.
+    void ApportionShares(std::int32_t Node, std::int32_t Available, const FOutputShares& OutputShares);
+
+    // Aggregates all nodes and allocates the target input rate of the root. On failure, FailedNode is set to the
+    // node that could not be allocated.
+    EAllocationResult Solve(std::int32_t& FailedNode);
+};
@@ -2,6 +2,8 @@
 
 #pragma once
 
+#include <atomic>
+
 #include "CoreMinimal.h"
 #include "Subsystem/ModSubsystem.h"
 #include "Buildables/MFGBuildableAutoSplitter.h"
@@ -12,6 +14,15 @@
 
 #include "AutoSplittersSubsystem.generated.h"
 
+// far end of the conveyors attached to a splitter connection
+struct FAutoSplitterConveyorChain
+{
+    // buildable owning the connection at the end of the chain, nullptr if the chain is not connected
+    AFGBuildable* Endpoint;
+    // lowest belt rate along the chain, INT32_MAX without any belts
+    int32 MaxRate;
+};
+
 UENUM()
 enum class EAAutoSplittersSubsystemSeverity : uint8
 {
@@ -69,12 +80,46 @@ private:
 
     bool mIsNewSession;
 
+    // world time of the last statistics reset
+    float mStatisticsResetTime;
+
+    // cached network topologies, keyed by their root splitter
+    TMap<AMFGBuildableAutoSplitter*,TUniquePtr<AMFGBuildableAutoSplitter::FNetwork>> mNetworks;
+
+    // splitters whose network needs balancing, processed once per frame. Factory ticks may add to it concurrently.
+    TArray<TWeakObjectPtr<AMFGBuildableAutoSplitter>> mBalancingQueue;
+    FCriticalSection mBalancingQueueLock;
+
+    // full balancing runs in progress, each one only writes to the splitters of its own network
+    TArray<AMFGBuildableAutoSplitter::FBalancingJob> mBalancingJobs;
+
+    // dropped networks, kept around so their storage can be reused by the next discovery
+    TArray<TUniquePtr<AMFGBuildableAutoSplitter::FNetwork>> mSpareNetworks;
+
+    // bumped whenever conveyors, splitters or their connections change, which makes all cached networks stale
+    std::atomic<uint32> mTopologyGeneration;
+
+    // conveyor chains attached to splitter connections, only valid for mConveyorChainsGeneration
+    TMap<UFGFactoryConnectionComponent*,FAutoSplitterConveyorChain> mConveyorChains;
+    uint32 mConveyorChainsGeneration;
+    FRWLock mConveyorChainsLock;
+
+    static FAutoSplitterConveyorChain WalkConveyorChain(UFGFactoryConnectionComponent* Connection, bool Forward);
+
     static AAutoSplittersSubsystem* FindAndGet(UObject* WorldContext,bool FailIfMissing);
 
 protected:
 
     virtual void Init() override;
     virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+    virtual void Tick(float DeltaSeconds) override;
+
+    // starts a balancing job for the network of every queued splitter, each network only once
+    void ProcessBalancingQueue();
+
+    // Works on the balancing jobs until AutoSplitters.BalancingBudgetMs is used up. Discovery goes through the shared
+    // caches and runs on the game thread, the rest of the jobs run in parallel.
+    void RunBalancingJobs();
 
 public:
 
@@ -122,6 +167,55 @@ public:
 
     void NotifyChat(ESeverity Severity,FString Msg) const;
 
+    uint32 GetTopologyGeneration() const
+    {
+        return mTopologyGeneration;
+    }
+
+    void InvalidateTopology()
+    {
+        ++mTopologyGeneration;
+    }
+
+    // Returns the far end of the conveyors attached to Connection, following them downstream if Forward is set.
+    // Each connection only walks its belts once per topology generation.
+    FAutoSplitterConveyorChain FindConveyorChain(UFGFactoryConnectionComponent* Connection, bool Forward);
+
+    // Queues the network of Splitter for balancing during the next subsystem tick
+    void RequestBalancing(AMFGBuildableAutoSplitter* Splitter);
+
+    // Returns an empty network to discover into, reusing the storage of dropped networks where possible
+    TUniquePtr<AMFGBuildableAutoSplitter::FNetwork> AcquireNetwork();
+
+    // Hands back a network from AcquireNetwork() that could not be discovered completely
+    void ReleaseNetwork(TUniquePtr<AMFGBuildableAutoSplitter::FNetwork>&& Network);
+
+    // Takes ownership of a freshly discovered network and links its splitters to their nodes. Stale networks from
+    // earlier generations get dropped on the way.
+    AMFGBuildableAutoSplitter::FNetwork& StoreNetwork(
+        AMFGBuildableAutoSplitter* Root,
+        TUniquePtr<AMFGBuildableAutoSplitter::FNetwork>&& Network
+        );
+
+    // sums up the statistics of all splitters, only available on the server
+    UFUNCTION(BlueprintCallable)
+    FAutoSplitterStatistics GetGlobalStatistics() const;
+
+    // sums up the statistics of all splitters in the network of Splitter, only available on the server
+    UFUNCTION(BlueprintCallable)
+    FAutoSplitterStatistics GetNetworkStatistics(AMFGBuildableAutoSplitter* Splitter) const;
+
+    UFUNCTION(BlueprintCallable)
+    void ResetStatistics();
+
+    // seconds since the statistics were last reset
+    UFUNCTION(BlueprintPure)
+    float GetStatisticsTime() const;
+
+    // implementation of the AutoSplitters.Stats and AutoSplitters.ResetStats console commands
+    static void StatisticsCommand(const TArray<FString>& Args, UWorld* World);
+    static void ResetStatisticsCommand(const TArray<FString>& Args, UWorld* World);
+
     virtual void PreSaveGame_Implementation(int32 saveVersion, int32 gameVersion) override;
     //virtual void PostSaveGame_Implementation(int32 saveVersion, int32 gameVersion) override;
     //virtual void PreLoadGame_Implementation(int32 saveVersion, int32 gameVersion) override;
@@ -0,0 +1,141 @@
+// ILikeBanas
+
+#pragma once
+
+#include <array>
+
+#include "CoreMinimal.h"
+
+// Per-splitter trace of distribution and balancing events. Recording only copies a few integers into a fixed ring
+// buffer, all string formatting is deferred until the trace gets dumped. The events recorded on every tick get a ring of
+// their own, so they cannot push the last setup or balancing out of the trace.
+
+enum class EAutoSplitterTraceEvent : uint8
+{
+    // items assigned to the outputs during a tick: (output 0, output 1, output 2)
+    Assign,
+    // all eligible outputs blocked: (unassigned items, left in cycle)
+    Blocked,
+    // (new cycle length, cycle time in ms)
+    CycleExtended,
+    CycleShortened,
+    // (left in cycle before reset)
+    CycleReset,
+    // distribution setup: (items per cycle for outputs 0, 1, 2)
+    Setup,
+    // splitter went to sleep: (buffered items)
+    Sleep,
+    // balancing started for the network rooted at this splitter
+    BalanceStart,
+    // allocated rates: (output 0, output 1, output 2)
+    BalanceRates,
+    // allocated rate had to be rounded: (output, rounding in 1/100000 of a rate unit)
+    BalanceRemainder,
+    // (fixed demand, available input)
+    BalanceInvalid,
+    // the next three outputs of the preceding per-output event on wider splitters
+    MoreOutputs,
+};
+
+struct FAutoSplitterTraceRecord
+{
+    // orders the records of both rings
+    uint32 Sequence;
+    uint32 Frame;
+    EAutoSplitterTraceEvent Event;
+    int32 Data[3];
+};
+
+class AUTOSPLITTERS_API FAutoSplitterTrace
+{
+public:
+
+    // capacity of each of the two rings
+    static constexpr uint32 CAPACITY = 32;
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0,"trace capacity must be a power of two");
+
+    FAutoSplitterTrace()
+        : mSequence(0)
+    {}
+
+    FORCEINLINE void Record(EAutoSplitterTraceEvent Event, int32 A = 0, int32 B = 0, int32 C = 0)
+    {
+        Append(GetRing(Event),Event,A,B,C);
+    }
+
+    // Records the values of the first Count outputs, wider splitters get MoreOutputs records for the rest
+    template <typename ValuesType>
+    FORCEINLINE void RecordOutputs(EAutoSplitterTraceEvent Event, const ValuesType& Values, int32 Count)
+    {
+        // continuation records go into the ring of the event they belong to
+        auto& Ring = GetRing(Event);
+        Append(Ring,Event,Values[0],Values[1],Values[2]);
+        for (int32 i = 3 ; i < Count ; i += 3)
+        {
+            Append(
+                Ring,
+                EAutoSplitterTraceEvent::MoreOutputs,
+                Values[i],
+                i + 1 < Count ? Values[i + 1] : 0,
+                i + 2 < Count ? Values[i + 2] : 0
+                );
+        }
+    }
+
+    uint32 Num() const
+    {
+        return mTickRing.Num() + mEventRing.Num();
+    }
+
+    // Appends one line per recorded event to Out, oldest first
+    void Format(FString& Out) const;
+
+    static const TCHAR* GetEventName(EAutoSplitterTraceEvent Event);
+
+    // events that get recorded on every tick of a busy splitter
+    static constexpr bool IsTickEvent(EAutoSplitterTraceEvent Event)
+    {
+        return Event == EAutoSplitterTraceEvent::Assign
+            || Event == EAutoSplitterTraceEvent::Blocked
+            || Event == EAutoSplitterTraceEvent::Sleep;
+    }
+
+private:
+
+    struct FRing
+    {
+        std::array<FAutoSplitterTraceRecord,CAPACITY> Records;
+        uint32 Next = 0;
+
+        uint32 Num() const
+        {
+            return Next < CAPACITY ? Next : CAPACITY;
+        }
+
+        // Index-th oldest record
+        const FAutoSplitterTraceRecord& operator[](uint32 Index) const
+        {
+            return Records[(Next - Num() + Index) & (CAPACITY - 1)];
+        }
+    };
+
+    FRing& GetRing(EAutoSplitterTraceEvent Event)
+    {
+        return IsTickEvent(Event) ? mTickRing : mEventRing;
+    }
+
+    FORCEINLINE void Append(FRing& Ring, EAutoSplitterTraceEvent Event, int32 A, int32 B, int32 C)
+    {
+        auto& Record = Ring.Records[Ring.Next++ & (CAPACITY - 1)];
+        Record.Sequence = mSequence++;
+        Record.Frame = static_cast<uint32>(GFrameCounter);
+        Record.Event = Event;
+        Record.Data[0] = A;
+        Record.Data[1] = B;
+        Record.Data[2] = C;
+    }
+
+    FRing mTickRing;
+    FRing mEventRing;
+    uint32 mSequence;
+};